@@ -20,6 +20,7 @@ class BrocsegRecipe(ConanFile):
         self.requires("glm/cci.20230113")
         self.requires("imgui/1.91.0")
         self.requires("openmesh/11.0")
+        self.requires("benchmark/1.8.4")
 
     def generate(self):
         copy(self, "*sdl*", os.path.join(self.dependencies["imgui"].package_folder,
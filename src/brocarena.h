@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "broccommon.h"
+
+namespace brocseg {
+namespace mem {
+
+// Monotonic bump allocator for scratch that lives exactly as long as one operation. Spans stay
+// valid until reset(); nothing is freed one by one and no destructors run, so only trivial
+// types go in. Blocks are kept across resets and refilled in order, so a round that repeats
+// the allocations of an earlier one never touches the heap.
+class arena {
+public:
+  explicit arena(size_t blockBytes = 64 * 1024) : blockBytes_(blockBytes) {}
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+  arena(arena &&) = default;
+  arena &operator=(arena &&) = default;
+
+  // n uninitialised Ts
+  template <typename T> std::span<T> alloc(size_t n) {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+    static_assert(alignof(T) <= alignment);
+    size_t bytes = (n * sizeof(T) + alignment - 1) & ~(alignment - 1);
+    if (current_ == blocks_.size() || bytes > blocks_[current_].size - used_) {
+      grow(bytes);
+    }
+    T *p = reinterpret_cast<T *>(blocks_[current_].data.get() + used_);
+    used_ += bytes;
+    return {p, n};
+  }
+
+  template <typename T> std::span<T> alloc(size_t n, const T &value) {
+    std::span<T> result = alloc<T>(n);
+    std::fill(result.begin(), result.end(), value);
+    return result;
+  }
+
+  // invalidates every span handed out since the last reset
+  void reset() {
+    current_ = 0;
+    used_ = 0;
+  }
+
+private:
+  // what new[] guarantees for the blocks
+  static constexpr size_t alignment = alignof(std::max_align_t);
+
+  struct block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+
+  // moves on to the next kept block big enough, or adds one
+  void grow(size_t bytes) {
+    used_ = 0;
+    while (current_ < blocks_.size() && ++current_ < blocks_.size()) {
+      if (blocks_[current_].size >= bytes) {
+        return;
+      }
+    }
+    size_t size = std::max(bytes, blockBytes_);
+    blocks_.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+    current_ = blocks_.size() - 1;
+  }
+
+  size_t blockBytes_;
+  std::vector<block> blocks_;
+  size_t current_ = 0;
+  size_t used_ = 0;
+};
+
+// Heap allocations made by the program so far. Only counted where BROC_COUNT_ALLOCATIONS is
+// defined in exactly one translation unit before this header, which replaces operator new.
+inline std::atomic<u64> heapAllocations{0};
+
+} // namespace mem
+} // namespace brocseg
+
+#ifdef BROC_COUNT_ALLOCATIONS
+void *operator new(size_t size) {
+  brocseg::mem::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,648 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// broc
+// counts every operator new, for the allocation check of repeated cuts
+#define BROC_COUNT_ALLOCATIONS
+#include "brocarena.h"
+#include "broccache.h"
+#include "broccommon.h"
+#include "broccurv.h"
+#include "brocflow.h"
+#include "brocmath.h"
+#include "brocmesh.h"
+#include "brocsimd.h"
+#include "brocwalker.h"
+
+#include <benchmark/benchmark.h>
+
+// Microbenchmarks for the curvature, percentile and graph-cut hot paths on synthetic
+// icospheres, noisy tori and grids from 1k to 10M vertices, and on stl/leg.stl.
+// Throughput is items_per_second with one item per vertex, peakRSS is in MiB.
+// Pick a subset with e.g. --benchmark_filter='torus_1M' or --benchmark_filter='^mincut/'.
+// Every mincut run is checked against the Boykov-Kolmogorov cut and fails on disagreement.
+// mincut/session repeats the viewer click cut and fails if it touches the heap.
+
+namespace {
+
+using namespace brocseg;
+
+struct benchMesh {
+  std::string name;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<u32> indices;
+  math::OneRing ring;
+};
+
+struct meshSpec {
+  std::string name;
+  size_t nVertices; // approximate for generated meshes, known before they are built
+  std::function<benchMesh()> build;
+};
+
+double peakRssMiB() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc;
+  GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+  return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+// the pipeline functions log to stderr, keep that out of the benchmark output
+class quietLog {
+public:
+  quietLog() : old_(std::cerr.rdbuf(&sink_)) {}
+  ~quietLog() { std::cerr.rdbuf(old_); }
+
+private:
+  // drops everything without buffering it, so logging does not allocate either
+  struct nullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+  };
+
+  nullBuffer sink_;
+  std::streambuf *old_;
+};
+
+void finishMesh(benchMesh &mesh) {
+  // area weighted vertex normals
+  mesh.normals.assign(mesh.positions.size(), glm::vec3(0.0f));
+  for (size_t f = 0; f + 2 < mesh.indices.size(); f += 3) {
+    const glm::vec3 &a = mesh.positions[mesh.indices[f]];
+    glm::vec3 n = glm::cross(mesh.positions[mesh.indices[f + 1]] - a,
+                             mesh.positions[mesh.indices[f + 2]] - a);
+    for (int k = 0; k < 3; ++k) {
+      mesh.normals[mesh.indices[f + k]] += n;
+    }
+  }
+  for (glm::vec3 &n : mesh.normals) {
+    float len = glm::length(n);
+    n = (len > 0.0f) ? n / len : glm::vec3(0.0f, 0.0f, 1.0f);
+  }
+  mesh.ring = math::oneRingFromFaces(mesh.positions.size(), mesh.indices);
+}
+
+benchMesh gridMesh(size_t n) {
+  const u32 side = std::max<u32>(2, static_cast<u32>(std::ceil(std::sqrt(double(n)))));
+  benchMesh mesh;
+  mesh.name = "grid";
+  for (u32 i = 0; i < side; ++i) {
+    for (u32 j = 0; j < side; ++j) {
+      float x = float(i) / (side - 1);
+      float y = float(j) / (side - 1);
+      mesh.positions.push_back(glm::vec3(x, y, 0.05f * std::sin(8.0f * x) * std::cos(8.0f * y)));
+    }
+  }
+  for (u32 i = 0; i + 1 < side; ++i) {
+    for (u32 j = 0; j + 1 < side; ++j) {
+      u32 a = i * side + j;
+      u32 b = a + side;
+      mesh.indices.insert(mesh.indices.end(), {a, b, b + 1, a, b + 1, a + 1});
+    }
+  }
+  finishMesh(mesh);
+  return mesh;
+}
+
+benchMesh torusMesh(size_t n) {
+  const u32 minor = std::max<u32>(3, static_cast<u32>(std::sqrt(n / 2.0)));
+  const u32 major = std::max<u32>(3, static_cast<u32>(n / minor));
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+  benchMesh mesh;
+  mesh.name = "torus";
+  for (u32 i = 0; i < major; ++i) {
+    for (u32 j = 0; j < minor; ++j) {
+      float u = 2.0f * math::pi * i / major;
+      float v = 2.0f * math::pi * j / minor;
+      float r = 1.0f + noise(rng);
+      mesh.positions.push_back(glm::vec3((3.0f + r * std::cos(v)) * std::cos(u),
+                                         (3.0f + r * std::cos(v)) * std::sin(u), r * std::sin(v)));
+    }
+  }
+  for (u32 i = 0; i < major; ++i) {
+    for (u32 j = 0; j < minor; ++j) {
+      u32 a = i * minor + j;
+      u32 b = ((i + 1) % major) * minor + j;
+      u32 c = ((i + 1) % major) * minor + (j + 1) % minor;
+      u32 d = i * minor + (j + 1) % minor;
+      mesh.indices.insert(mesh.indices.end(), {a, b, c, a, c, d});
+    }
+  }
+  finishMesh(mesh);
+  return mesh;
+}
+
+// 10 * 4^level + 2 vertices
+benchMesh icosphereMesh(int level) {
+  const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+  benchMesh mesh;
+  mesh.name = "icosphere";
+  mesh.positions = {{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0}, {0, -1, t}, {0, 1, t},
+                    {0, -1, -t}, {0, 1, -t}, {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+  mesh.indices = {0, 11, 5,  0, 5,  1, 0, 1, 7, 0, 7,  10, 0, 10, 11, 1, 5, 9, 5, 11,
+                  4, 11, 10, 2, 10, 7, 6, 7, 1, 8, 3, 9,  4, 3,  4,  2, 3, 2, 6, 3,
+                  6, 8,  3,  8, 9,  4, 9, 5, 2, 4, 11, 6,  2, 10, 8,  6, 7, 9, 8, 1};
+  for (int l = 0; l < level; ++l) {
+    // one new vertex per edge, found by binary search over the sorted edge keys
+    std::vector<u64> edges;
+    edges.reserve(mesh.indices.size());
+    auto key = [](u32 a, u32 b) { return (u64(std::min(a, b)) << 32) | std::max(a, b); };
+    for (size_t f = 0; f < mesh.indices.size(); f += 3) {
+      for (int k = 0; k < 3; ++k) {
+        edges.push_back(key(mesh.indices[f + k], mesh.indices[f + (k + 1) % 3]));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    const u32 base = static_cast<u32>(mesh.positions.size());
+    for (u64 e : edges) {
+      mesh.positions.push_back(0.5f * (mesh.positions[e >> 32] + mesh.positions[e & 0xffffffffu]));
+    }
+    auto mid = [&](u32 a, u32 b) {
+      return base + static_cast<u32>(std::lower_bound(edges.begin(), edges.end(), key(a, b)) -
+                                     edges.begin());
+    };
+    std::vector<u32> indices;
+    indices.reserve(4 * mesh.indices.size());
+    for (size_t f = 0; f < mesh.indices.size(); f += 3) {
+      u32 a = mesh.indices[f];
+      u32 b = mesh.indices[f + 1];
+      u32 c = mesh.indices[f + 2];
+      u32 ab = mid(a, b);
+      u32 bc = mid(b, c);
+      u32 ca = mid(c, a);
+      indices.insert(indices.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+    }
+    mesh.indices = std::move(indices);
+  }
+  for (glm::vec3 &p : mesh.positions) {
+    p = glm::normalize(p);
+  }
+  finishMesh(mesh);
+  return mesh;
+}
+
+benchMesh fileMesh(const std::string &path) {
+  quietLog quiet;
+  math::coreMesh core = loadCoreMesh(path);
+  benchMesh mesh;
+  mesh.name = path;
+  mesh.positions = std::move(core.positions);
+  mesh.normals = std::move(core.normals);
+  mesh.indices = std::move(core.indices);
+  mesh.ring = std::move(core.ring);
+  return mesh;
+}
+
+// benchmarks are registered mesh by mesh, so one cached mesh at a time is enough
+const benchMesh &meshFor(const meshSpec &spec) {
+  static std::string cachedName;
+  static benchMesh cached;
+  if (cachedName != spec.name) {
+    cached = benchMesh{};
+    cached = spec.build();
+    cachedName = spec.name;
+  }
+  return cached;
+}
+
+void setCounters(benchmark::State &state, const benchMesh &mesh) {
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * mesh.positions.size()));
+  state.counters["vertices"] = static_cast<double>(mesh.positions.size());
+  state.counters["peakRSS"] = peakRssMiB();
+}
+
+std::vector<glm::vec3> adjacentPositions(const benchMesh &mesh, u32 v) {
+  std::vector<glm::vec3> adjacent;
+  for (u32 i = mesh.ring.offsets[v]; i < mesh.ring.offsets[v + 1]; ++i) {
+    adjacent.push_back(mesh.positions[mesh.ring.vertices[i]]);
+  }
+  return adjacent;
+}
+
+// per-vertex reference functions from brocmath.h
+void benchMeanCurvature(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  for (auto _ : state) {
+    for (u32 v = 0; v < mesh.positions.size(); ++v) {
+      benchmark::DoNotOptimize(
+          math::meanCurvature(mesh.positions[v], adjacentPositions(mesh, v), mesh.normals[v]));
+    }
+  }
+  setCounters(state, mesh);
+}
+
+void benchGaussianCurvature(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  for (auto _ : state) {
+    for (u32 v = 0; v < mesh.positions.size(); ++v) {
+      benchmark::DoNotOptimize(
+          math::gaussianCurvature(mesh.positions[v], adjacentPositions(mesh, v)));
+    }
+  }
+  setCounters(state, mesh);
+}
+
+// the batched engine computePerVertexMeanCurvature runs on
+void benchCurvatures(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices));
+  }
+  setCounters(state, mesh);
+}
+
+// the face kernel the cpu picks on the mesh plus random and degenerate faces (repeated vertices,
+// collinear corners), checked against the scalar reference before it is timed
+void benchFaceGeometry(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<glm::vec3> positions = mesh.positions;
+  std::vector<u32> indices = mesh.indices;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> coord(-1.0f, 1.0f);
+  for (int i = 0; i < 3 * 1024; ++i) {
+    indices.push_back(static_cast<u32>(positions.size()));
+    positions.push_back({coord(rng), coord(rng), coord(rng)});
+  }
+  const u32 o = static_cast<u32>(positions.size());
+  positions.insert(positions.end(), {{0, 0, 0}, {1, 0, 0}, {2, 0, 0}, {0, 1, 0}});
+  for (int i = 0; i < 8; ++i) {
+    indices.insert(indices.end(), {o, o, o + 3, o, o + 1, o + 2, o + 1, o + 1, o + 1});
+  }
+  const size_t nFaces = indices.size() / 3;
+  math::FaceGeometry reference;
+  reference.resize(nFaces);
+  math::simd::faceGeometryScalar(positions.data(), indices.data(), 0, nFaces, reference);
+  math::simd::faceGeometryKernel kernel = math::simd::selectFaceGeometryKernel();
+  math::FaceGeometry result;
+  result.resize(nFaces);
+  kernel(positions.data(), indices.data(), 0, nFaces, result);
+  auto close = [](const std::vector<float> &a, const std::vector<float> &b, float tolerance) {
+    for (size_t f = 0; f < a.size(); ++f) {
+      if (!(std::abs(a[f] - b[f]) <= tolerance * std::max(1.0f, std::abs(a[f])))) {
+        return false;
+      }
+    }
+    return true;
+  };
+  bool agree = close(reference.area, result.area, 1e-4f);
+  for (int k = 0; k < 3; ++k) {
+    agree = agree && close(reference.cot[k], result.cot[k], 1e-3f) &&
+            close(reference.angle[k], result.angle[k], 1e-5f) &&
+            close(reference.mixed[k], result.mixed[k], 1e-3f);
+  }
+  if (!agree) {
+    state.SkipWithError("face kernel differs from the scalar reference");
+  }
+  for (auto _ : state) {
+    kernel(positions.data(), indices.data(), 0, nFaces, result);
+    benchmark::DoNotOptimize(result.area.data());
+  }
+  setCounters(state, mesh);
+}
+
+void benchPercentileThreshold(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> curvatures =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(math::percentileThreshold(curvatures, 0.9f));
+  }
+  setCounters(state, mesh);
+}
+
+// one slider tick once the cache is built
+void benchPercentileQuery(benchmark::State &state, const meshSpec &spec, bool approximate) {
+  const benchMesh &mesh = meshFor(spec);
+  math::percentileCache percentiles{
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean};
+  float percentile = 0.5f;
+  for (auto _ : state) {
+    percentile = (percentile < 0.95f) ? percentile + 0.01f : 0.5f;
+    benchmark::DoNotOptimize(approximate ? percentiles.approximateThreshold(percentile)
+                                         : percentiles.threshold(percentile));
+  }
+  setCounters(state, mesh);
+}
+
+// the copy a warm start pays: every array of a mapped cache file into an owning core mesh
+void benchCacheCore(benchmark::State &state, const meshSpec &spec) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  math::coreMesh core = math::coreMeshFromTriangles(mesh.positions, mesh.normals, mesh.indices);
+  std::error_code ec;
+  std::string path = (std::filesystem::temp_directory_path(ec) / "brocbench.broccache").string();
+  cache::meshCache::build({}, core, math::computeCurvatures(core)).write(path);
+  std::optional<cache::meshCache> mapped = cache::meshCache::open(path, {});
+  if (!mapped) {
+    state.SkipWithError("cannot map the cache file");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mapped->core().positions.data());
+  }
+  mapped.reset();
+  std::filesystem::remove(path, ec);
+  setCounters(state, mesh);
+}
+
+// topology and capacities colorByBorders builds before cutting
+void benchAdjacency(benchmark::State &state, const meshSpec &spec) {
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> energy =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  for (float &e : energy) {
+    e = curvatureToQuality(e);
+  }
+  for (auto _ : state) {
+    math::flownet g = flownetFromRing(mesh.ring);
+    g.capacity_ = cutCapacities(g, energy);
+    benchmark::DoNotOptimize(g.capacity_.data());
+  }
+  setCounters(state, mesh);
+}
+
+// Cap is the capacity type, the reference is boykov-kolmogorov on the same type
+template <typename Cap>
+void benchMincut(benchmark::State &state, const meshSpec &spec, math::maxflow algorithm) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> curvatures =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  std::vector<float> energy =
+      energyFromCurvatures(curvatures, math::percentileCache{curvatures}, 0.9f);
+  math::basicFlownet<Cap> g = flownetFromRing<Cap>(mesh.ring);
+  g.capacity_ = cutCapacities(g, energy);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> vertexDist(0, mesh.positions.size() - 1);
+  size_t sIdx = vertexDist(rng);
+  size_t tIdx = vertexDist(rng);
+  while (tIdx == sIdx) {
+    tIdx = vertexDist(rng);
+  }
+  std::vector<size_t> reference = g.mincut(sIdx, tIdx, math::maxflow::boykovKolmogorov);
+  for (auto _ : state) {
+    std::vector<size_t> sVertices = g.mincut(sIdx, tIdx, algorithm);
+    if (sVertices != reference) {
+      state.SkipWithError("cut differs from boykov-kolmogorov");
+      break;
+    }
+  }
+  setCounters(state, mesh);
+}
+
+// the viewer click path: a warm session cut with its fill-in, after a first cut has sized the
+// solver and the scratch arena; fails if a repeated cut still allocates
+void benchSessionCut(benchmark::State &state, const meshSpec &spec) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> curvatures =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  std::vector<float> energy =
+      energyFromCurvatures(curvatures, math::percentileCache{curvatures}, 0.9f);
+  math::cutSession session{flownetFromRing(mesh.ring)};
+  size_t sIdx = 0;
+  size_t tIdx = mesh.positions.size() / 2;
+  colorByBorders(session, mesh.ring, sIdx, tIdx, energy);
+  u64 allocations = mem::heapAllocations.load();
+  u64 cuts = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(colorByBorders(session, mesh.ring, sIdx, tIdx, energy).data());
+    ++cuts;
+  }
+  allocations = mem::heapAllocations.load() - allocations;
+  if (allocations != 0) {
+    state.SkipWithError("repeated cut allocated");
+  }
+  state.counters["allocsPerCut"] = static_cast<double>(allocations) / std::max<u64>(cuts, 1);
+  setCounters(state, mesh);
+}
+
+// a coarse to fine cut on a pyramid built beforehand, with the fraction of vertices it labels
+// as the exact cut does
+void benchMultiscaleCut(benchmark::State &state, const meshSpec &spec) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> curvatures =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  std::vector<float> energy =
+      energyFromCurvatures(curvatures, math::percentileCache{curvatures}, 0.9f);
+  math::flownet g = flownetFromRing(mesh.ring);
+  g.capacity_ = cutCapacities(g, energy);
+  math::multiscaleCut pyramid{mesh.ring, mesh.positions, g.capacity_};
+  u32 source = 0;
+  u32 sink = static_cast<u32>(mesh.positions.size() / 2);
+  std::vector<size_t> exact = g.mincut(source, sink, math::maxflow::boykovKolmogorov);
+  mem::arena arena;
+  std::span<u32> cut;
+  for (auto _ : state) {
+    arena.reset();
+    cut = pyramid.cut(mesh.ring, {&source, 1}, {&sink, 1}, arena);
+    benchmark::DoNotOptimize(cut.data());
+  }
+  std::vector<u8> side(mesh.positions.size(), 0);
+  for (size_t v : exact) {
+    side[v] ^= 1;
+  }
+  for (u32 v : cut) {
+    side[v] ^= 1;
+  }
+  size_t differing = std::count(side.begin(), side.end(), u8{1});
+  state.counters["agreement"] = 1.0 - static_cast<double>(differing) / side.size();
+  state.counters["levels"] = static_cast<double>(pyramid.nLevels());
+  setCounters(state, mesh);
+}
+
+// random walker labels for two seeds: cold builds the walker from the mesh every time, warm
+// moves the sink between two vertices so every call rebuilds the hierarchy and starts from the
+// potentials of the last one
+void benchRandomWalker(benchmark::State &state, const meshSpec &spec, bool warm) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  std::vector<float> curvatures =
+      math::computeCurvatures(mesh.positions, mesh.normals, mesh.indices).mean;
+  std::vector<float> energy =
+      energyFromCurvatures(curvatures, math::percentileCache{curvatures}, 0.9f);
+  math::VertexCorners corners = math::vertexCornersFromFaces(mesh.positions.size(), mesh.indices);
+  std::vector<float> cotan = math::cotanWeights(mesh.positions, mesh.indices, mesh.ring, corners);
+  const u32 n = static_cast<u32>(mesh.positions.size());
+  std::vector<std::vector<u32>> seeds = {{0}, {n / 2}};
+  math::randomWalker walker{cotan};
+  walker.setEnergy(mesh.ring, energy);
+  walker.segment(mesh.ring, seeds);
+  u64 iterations = 0;
+  u64 solves = 0;
+  for (auto _ : state) {
+    if (warm) {
+      seeds[1][0] = (seeds[1][0] == n / 2) ? n / 2 + 1 : n / 2;
+    } else {
+      walker = math::randomWalker{math::cotanWeights(mesh.positions, mesh.indices, mesh.ring,
+                                                     corners)};
+      walker.setEnergy(mesh.ring, energy);
+    }
+    benchmark::DoNotOptimize(walker.segment(mesh.ring, seeds).data());
+    iterations += walker.iterations();
+    ++solves;
+  }
+  state.counters["iterations"] = static_cast<double>(iterations) / std::max<u64>(solves, 1);
+  state.counters["levels"] = static_cast<double>(walker.nLevels());
+  setCounters(state, mesh);
+}
+
+// three labels on a fresh walker, stopped after two polls as the viewer's cancel does: the labels
+// still cover every vertex and the unsolved potentials are sized
+void benchCancelledWalker(benchmark::State &state, const meshSpec &spec) {
+  quietLog quiet;
+  const benchMesh &mesh = meshFor(spec);
+  math::VertexCorners corners = math::vertexCornersFromFaces(mesh.positions.size(), mesh.indices);
+  std::vector<float> cotan = math::cotanWeights(mesh.positions, mesh.indices, mesh.ring, corners);
+  const u32 n = static_cast<u32>(mesh.positions.size());
+  std::vector<std::vector<u32>> seeds = {{0}, {n / 3}, {2 * n / 3}};
+  const std::vector<float> flat(n, 0.0f);
+  for (auto _ : state) {
+    math::randomWalker walker{cotan};
+    walker.setEnergy(mesh.ring, flat);
+    int polls = 0;
+    std::vector<u32> label = walker.segment(mesh.ring, seeds, {}, [&polls] {
+      return ++polls > 2;
+    });
+    bool sized = label.size() == n;
+    for (size_t k = 0; k < seeds.size(); ++k) {
+      sized = sized && walker.potential(k).size() == n;
+    }
+    if (!sized || std::any_of(label.begin(), label.end(), [](u32 l) { return l > 2; })) {
+      state.SkipWithError("cancelled walker left labels unsized");
+      break;
+    }
+  }
+  setCounters(state, mesh);
+}
+
+std::string sizeName(size_t n) {
+  if (n >= 1000000) {
+    return std::to_string(n / 1000000) + "M";
+  }
+  return std::to_string(n / 1000) + "k";
+}
+
+std::vector<meshSpec> meshSpecs(const std::vector<std::string> &files) {
+  std::vector<meshSpec> specs;
+  for (const std::string &path : files) {
+    if (std::ifstream(path).good()) {
+      // loaded for its size, meshFor keeps it for the first benchmark on it
+      meshSpec spec{path, 0, [path] { return fileMesh(path); }};
+      spec.nVertices = meshFor(spec).positions.size();
+      specs.push_back(std::move(spec));
+    }
+  }
+  const size_t sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+  for (size_t n : sizes) {
+    int level = static_cast<int>(std::lround(std::log((n - 2) / 10.0) / std::log(4.0)));
+    specs.push_back({"icosphere_" + sizeName(n), n, [level] { return icosphereMesh(level); }});
+    specs.push_back({"torus_" + sizeName(n), n, [n] { return torusMesh(n); }});
+    specs.push_back({"grid_" + sizeName(n), n, [n] { return gridMesh(n); }});
+  }
+  return specs;
+}
+
+} // namespace
+
+// usage: brocseg_bench [benchmark flags] [mesh...] (defaults to stl/leg.stl)
+int main(int argc, char *argv[]) {
+  benchmark::Initialize(&argc, argv);
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    files.push_back(argv[i]);
+  }
+  if (files.empty()) {
+    files = {"stl/leg.stl"};
+  }
+
+  // the reference per-vertex functions and the augmenting path solvers are too slow for the
+  // biggest meshes
+  const size_t slowLimit = 1000000;
+  const size_t edmondsKarpLimit = 100000;
+  std::vector<meshSpec> specs = meshSpecs(files);
+  for (const meshSpec &spec : specs) {
+    const std::string &m = spec.name;
+    if (spec.nVertices < slowLimit) {
+      benchmark::RegisterBenchmark(("curvature/mean_reference/" + m).c_str(), benchMeanCurvature,
+                                   spec);
+      benchmark::RegisterBenchmark(("curvature/gaussian_reference/" + m).c_str(),
+                                   benchGaussianCurvature, spec);
+    }
+    benchmark::RegisterBenchmark(("curvature/batched/" + m).c_str(), benchCurvatures, spec);
+    benchmark::RegisterBenchmark(("curvature/faces/" + m).c_str(), benchFaceGeometry, spec);
+    benchmark::RegisterBenchmark(("percentile/threshold/" + m).c_str(), benchPercentileThreshold,
+                                 spec);
+    benchmark::RegisterBenchmark(("percentile/cached/" + m).c_str(), benchPercentileQuery, spec,
+                                 false);
+    benchmark::RegisterBenchmark(("percentile/approximate/" + m).c_str(), benchPercentileQuery,
+                                 spec, true);
+    benchmark::RegisterBenchmark(("adjacency/" + m).c_str(), benchAdjacency, spec);
+    benchmark::RegisterBenchmark(("cache/core/" + m).c_str(), benchCacheCore, spec)
+        ->Unit(benchmark::kMillisecond);
+    for (math::maxflow algorithm : {math::maxflow::edmondsKarp, math::maxflow::pushRelabel,
+                                    math::maxflow::boykovKolmogorov,
+                                    math::maxflow::capacityScaling}) {
+      if (algorithm != math::maxflow::pushRelabel &&
+          algorithm != math::maxflow::boykovKolmogorov && spec.nVertices >= edmondsKarpLimit) {
+        continue;
+      }
+      benchmark::RegisterBenchmark(
+          ("mincut/" + std::string(math::maxflowName(algorithm)) + "/" + m).c_str(),
+          benchMincut<i32>, spec, algorithm)
+          ->Unit(benchmark::kMillisecond);
+    }
+    // the same cut with wider and with unscaled floating point capacities
+    const std::string bk = "mincut/boykov-kolmogorov/";
+    benchmark::RegisterBenchmark((bk + "i64/" + m).c_str(), benchMincut<i64>, spec,
+                                 math::maxflow::boykovKolmogorov)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((bk + "float/" + m).c_str(), benchMincut<float>, spec,
+                                 math::maxflow::boykovKolmogorov)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((bk + "double/" + m).c_str(), benchMincut<double>, spec,
+                                 math::maxflow::boykovKolmogorov)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("mincut/session/" + m).c_str(), benchSessionCut, spec)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("mincut/multiscale/" + m).c_str(), benchMultiscaleCut, spec)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("walker/cold/" + m).c_str(), benchRandomWalker, spec, false)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("walker/warm/" + m).c_str(), benchRandomWalker, spec, true)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("walker/cancelled/" + m).c_str(), benchCancelledWalker, spec)
+        ->Unit(benchmark::kMillisecond);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
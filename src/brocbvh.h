@@ -0,0 +1,330 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "broccommon.h"
+#include "brocmath.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace math {
+
+struct rayHit {
+  u32 face;   // index of the triangle in the mesh index buffer
+  u32 corner; // 0..2, the triangle corner closest to the hit point
+  float t;    // origin + t * dir is the hit point
+};
+
+// Triangle bounding volume hierarchy, binned SAH build, for picking.
+class bvh {
+public:
+  bvh() = default;
+
+  bvh(const std::vector<glm::vec3> &positions, const std::vector<u32> &indices) {
+    BROC_ZONE("bvh build");
+    const u32 nFaces = static_cast<u32>(indices.size() / 3);
+    if (nFaces == 0) {
+      return;
+    }
+    // primitives are partitioned in place so the build walks memory sequentially
+    std::vector<primitive> prims(nFaces);
+    for (u32 f = 0; f < nFaces; ++f) {
+      for (int k = 0; k < 3; ++k) {
+        prims[f].bounds.addPoint(positions[indices[3 * f + k]]);
+      }
+      prims[f].centroid = 0.5f * (prims[f].bounds.minp + prims[f].bounds.maxp);
+      prims[f].face = f;
+    }
+
+    // the top of the tree is built here, subtrees below a size are deferred and built in
+    // parallel into their own node arrays, then appended
+    nodes_.reserve(2 * nFaces / maxLeafSize + 1);
+    nodes_.push_back({});
+    std::vector<task> deferred;
+    u32 parallelCount = (par::nThreads() > 1) ? nFaces / (4 * par::nThreads()) : 0;
+    build(nodes_, {0, 0, nFaces, 0}, prims, parallelCount, deferred);
+    std::vector<std::vector<node>> subtrees(deferred.size());
+    par::forChunks(deferred.size(), [&](size_t beg, size_t end) {
+      for (size_t i = beg; i < end; ++i) {
+        std::vector<task> none;
+        task root = deferred[i];
+        root.node = 0;
+        subtrees[i].push_back({});
+        build(subtrees[i], root, prims, 0, none);
+      }
+    }, 1);
+    for (size_t i = 0; i < deferred.size(); ++i) {
+      // local node j > 0 lands at base + j - 1, the local root replaces the placeholder
+      u32 base = static_cast<u32>(nodes_.size());
+      for (node &nd : subtrees[i]) {
+        if (nd.count == 0) {
+          nd.first += base - 1;
+        }
+      }
+      nodes_[deferred[i].node] = subtrees[i][0];
+      nodes_.insert(nodes_.end(), subtrees[i].begin() + 1, subtrees[i].end());
+    }
+
+    // leaves index straight into the triangles, stored in leaf order
+    triangles_.resize(nFaces);
+    for (u32 i = 0; i < nFaces; ++i) {
+      u32 f = prims[i].face;
+      const glm::vec3 &a = positions[indices[3 * f + 0]];
+      triangles_[i] = {a, positions[indices[3 * f + 1]] - a, positions[indices[3 * f + 2]] - a, f};
+    }
+  }
+
+  bool empty() const { return nodes_.empty(); }
+
+  // nearest triangle hit by the ray, both triangle sides count
+  std::optional<rayHit> intersect(const glm::vec3 &origin, const glm::vec3 &dir) const {
+    if (nodes_.empty()) {
+      return std::nullopt;
+    }
+    const glm::vec3 invDir = 1.0f / dir;
+    const float miss = std::numeric_limits<float>::infinity();
+    float bestT = miss;
+    u32 bestTriangle = 0;
+    u32 stack[maxDepth];
+    u32 sp = 0;
+    u32 nodeIdx = 0;
+    if (slab(nodes_[0], origin, invDir, bestT) == miss) {
+      return std::nullopt;
+    }
+    while (true) {
+      const node &nd = nodes_[nodeIdx];
+      if (nd.count > 0) {
+        for (u32 i = nd.first; i < nd.first + nd.count; ++i) {
+          float t = intersectTriangle(triangles_[i], origin, dir);
+          if (t < bestT) {
+            bestT = t;
+            bestTriangle = i;
+          }
+        }
+      } else {
+        u32 nearIdx = nd.first;
+        u32 farIdx = nd.first + 1;
+        float nearT = slab(nodes_[nearIdx], origin, invDir, bestT);
+        float farT = slab(nodes_[farIdx], origin, invDir, bestT);
+        if (farT < nearT) {
+          std::swap(nearIdx, farIdx);
+          std::swap(nearT, farT);
+        }
+        if (nearT != miss) {
+          if (farT != miss) {
+            stack[sp++] = farIdx;
+          }
+          nodeIdx = nearIdx;
+          continue;
+        }
+      }
+      if (sp == 0) {
+        break;
+      }
+      nodeIdx = stack[--sp];
+    }
+    if (bestT == miss) {
+      return std::nullopt;
+    }
+
+    const triangle &tri = triangles_[bestTriangle];
+    glm::vec3 p = origin + bestT * dir - tri.v0;
+    float d[3] = {len2(p), len2(p - tri.e1), len2(p - tri.e2)};
+    u32 corner = static_cast<u32>(std::min_element(d, d + 3) - d);
+    return rayHit{.face = tri.face, .corner = corner, .t = bestT};
+  }
+
+private:
+  static constexpr u32 maxLeafSize = 4;
+  static constexpr u32 maxDepth = 64;
+  static constexpr int nBins = 16;
+
+  struct node {
+    glm::vec3 lo;
+    u32 first; // first triangle for leaves, left child for inner nodes (right is first + 1)
+    glm::vec3 hi;
+    u32 count; // 0 for inner nodes
+  };
+
+  struct triangle {
+    glm::vec3 v0;
+    glm::vec3 e1;
+    glm::vec3 e2;
+    u32 face;
+  };
+
+  struct primitive {
+    BBox bounds;
+    glm::vec3 centroid;
+    u32 face;
+  };
+
+  struct task {
+    u32 node;
+    u32 beg;
+    u32 end;
+    u32 depth;
+  };
+
+  // builds the subtree of root into nodes, ranges of at most deferCount faces go to deferred
+  static void build(std::vector<node> &nodes, task root, std::vector<primitive> &prims,
+                    u32 deferCount, std::vector<task> &deferred) {
+    std::vector<task> tasks = {root};
+    while (!tasks.empty()) {
+      task tk = tasks.back();
+      tasks.pop_back();
+      u32 count = tk.end - tk.beg;
+      if (count <= deferCount && tk.node != root.node) {
+        deferred.push_back(tk);
+        continue;
+      }
+      BBox box;
+      BBox centroidBox;
+      for (u32 i = tk.beg; i < tk.end; ++i) {
+        box.addBox(prims[i].bounds);
+        centroidBox.addPoint(prims[i].centroid);
+      }
+      nodes[tk.node].lo = box.minp;
+      nodes[tk.node].hi = box.maxp;
+      u32 mid = (count > maxLeafSize && tk.depth + 1 < maxDepth)
+                    ? split(prims, tk.beg, tk.end, box, centroidBox)
+                    : tk.beg;
+      if (mid == tk.beg) {
+        nodes[tk.node].first = tk.beg;
+        nodes[tk.node].count = count;
+        continue;
+      }
+      u32 left = static_cast<u32>(nodes.size());
+      nodes[tk.node].first = left;
+      nodes[tk.node].count = 0;
+      nodes.push_back({});
+      nodes.push_back({});
+      tasks.push_back({left, tk.beg, mid, tk.depth + 1});
+      tasks.push_back({left + 1, mid, tk.end, tk.depth + 1});
+    }
+  }
+
+  // partitions prims[beg, end) along the cheapest binned SAH plane, returns beg for a leaf
+  static u32 split(std::vector<primitive> &prims, u32 beg, u32 end, const BBox &box,
+                   const BBox &centroidBox) {
+    const u32 count = end - beg;
+    const glm::vec3 lo = centroidBox.minp;
+    const glm::vec3 extent = centroidBox.maxp - centroidBox.minp;
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; ++axis) {
+      scale[axis] = (extent[axis] > 0.0f) ? nBins / extent[axis] : 0.0f;
+    }
+    auto binOf = [&](const primitive &prim, int axis) {
+      return std::min(nBins - 1, static_cast<int>((prim.centroid[axis] - lo[axis]) * scale[axis]));
+    };
+    // all three axes binned in one pass over the range
+    BBox binBox[3][nBins];
+    u32 binCount[3][nBins] = {};
+    for (u32 i = beg; i < end; ++i) {
+      for (int axis = 0; axis < 3; ++axis) {
+        int b = binOf(prims[i], axis);
+        binBox[axis][b].addBox(prims[i].bounds);
+        ++binCount[axis][b];
+      }
+    }
+
+    float bestCost = static_cast<float>(count) * box.halfArea();
+    int bestAxis = -1;
+    int bestBin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.0f) {
+        continue;
+      }
+      // sweep from the right for the suffix areas, then from the left for the cost
+      float rightArea[nBins];
+      u32 rightCount[nBins];
+      BBox acc;
+      u32 n = 0;
+      for (int b = nBins - 1; b > 0; --b) {
+        acc.addBox(binBox[axis][b]);
+        n += binCount[axis][b];
+        rightArea[b] = acc.halfArea();
+        rightCount[b] = n;
+      }
+      acc = BBox{};
+      n = 0;
+      for (int b = 0; b + 1 < nBins; ++b) {
+        acc.addBox(binBox[axis][b]);
+        n += binCount[axis][b];
+        if (n == 0 || rightCount[b + 1] == 0) {
+          continue;
+        }
+        float cost = n * acc.halfArea() + rightCount[b + 1] * rightArea[b + 1];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestBin = b;
+        }
+      }
+    }
+    if (bestAxis < 0) {
+      // no plane beats a leaf, but big leaves are slower than a median split
+      if (count <= 4 * maxLeafSize) {
+        return beg;
+      }
+      int axis = 0;
+      axis = (extent.y > extent[axis]) ? 1 : axis;
+      axis = (extent.z > extent[axis]) ? 2 : axis;
+      u32 mid = beg + count / 2;
+      std::nth_element(prims.begin() + beg, prims.begin() + mid, prims.begin() + end,
+                       [axis](const primitive &a, const primitive &b) {
+                         return a.centroid[axis] < b.centroid[axis];
+                       });
+      return mid;
+    }
+    auto it = std::partition(prims.begin() + beg, prims.begin() + end, [&](const primitive &prim) {
+      return binOf(prim, bestAxis) <= bestBin;
+    });
+    return static_cast<u32>(it - prims.begin());
+  }
+
+  // entry distance of the ray into the node box, infinity if it misses or starts beyond maxT
+  static float slab(const node &nd, const glm::vec3 &origin, const glm::vec3 &invDir, float maxT) {
+    glm::vec3 t0 = (nd.lo - origin) * invDir;
+    glm::vec3 t1 = (nd.hi - origin) * invDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+    float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, maxT));
+    return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+  }
+
+  // Moller-Trumbore, returns infinity on a miss
+  static float intersectTriangle(const triangle &tri, const glm::vec3 &origin,
+                                 const glm::vec3 &dir) {
+    const float miss = std::numeric_limits<float>::infinity();
+    glm::vec3 p = glm::cross(dir, tri.e2);
+    float det = glm::dot(tri.e1, p);
+    if (det == 0.0f) {
+      return miss;
+    }
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - tri.v0;
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) {
+      return miss;
+    }
+    glm::vec3 q = glm::cross(s, tri.e1);
+    float v = glm::dot(dir, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) {
+      return miss;
+    }
+    float t = glm::dot(tri.e2, q) * invDet;
+    return t > 0.0f ? t : miss;
+  }
+
+  std::vector<node> nodes_;
+  std::vector<triangle> triangles_;
+};
+
+} // namespace math
+} // namespace brocseg
@@ -0,0 +1,354 @@
+#pragma once
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "broccommon.h"
+#include "broccore.h"
+#include "broccurv.h"
+#include "brocmath.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace cache {
+
+// Read-only view of a whole file.
+class mappedFile {
+public:
+  mappedFile() = default;
+  mappedFile(const mappedFile &) = delete;
+  mappedFile &operator=(const mappedFile &) = delete;
+  mappedFile(mappedFile &&other) noexcept { *this = std::move(other); }
+  mappedFile &operator=(mappedFile &&other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+  ~mappedFile() { close(); }
+
+  bool open(const std::string &path) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(file);
+    if (mapping == nullptr) {
+      return false;
+    }
+    data_ = static_cast<const u8 *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+    size_ = data_ ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    data_ = static_cast<const u8 *>(p);
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+    return data_ != nullptr;
+  }
+
+  void close() {
+    if (data_) {
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap(const_cast<u8 *>(data_), size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const u8 *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const u8 *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// What a cache is valid for: the absolute source path, its size and modification time.
+struct sourceKey {
+  std::string path;
+  u64 size = 0;
+  i64 mtime = 0;
+
+  static std::optional<sourceKey> of(const std::string &path) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    if (ec) {
+      return std::nullopt;
+    }
+    u64 size = std::filesystem::file_size(absolute, ec);
+    if (ec) {
+      return std::nullopt;
+    }
+    auto mtime = std::filesystem::last_write_time(absolute, ec);
+    if (ec) {
+      return std::nullopt;
+    }
+    return sourceKey{absolute.generic_string(), size,
+                     static_cast<i64>(mtime.time_since_epoch().count())};
+  }
+};
+
+inline std::string cachePathFor(const std::string &meshPath) { return meshPath + ".broccache"; }
+
+// Mesh data in the layout of the cache file: a header, the source path, then one 64-byte
+// aligned array per section. Backed either by a mapping of the file or by the image it was
+// just built into, so a warm start reads straight out of the page cache.
+class meshCache {
+public:
+  static constexpr u32 version = 2;
+
+  // the arrays of math::coreMesh, then the curvatures
+  enum section : u32 {
+    positions,   // glm::vec3 per vertex
+    normals,     // glm::vec3 per vertex
+    indices,     // u32, three per triangle
+    ringOffsets, // u32 per vertex + 1
+    ringVertices,
+    cornerOffsets, // u32 per vertex + 1
+    corners,       // u32 per corner
+    opposite,      // u32 per corner
+    mean,          // float per vertex
+    gaussian,
+    k1,
+    k2,
+    nSections
+  };
+
+  meshCache(const meshCache &) = delete;
+  meshCache &operator=(const meshCache &) = delete;
+  meshCache(meshCache &&) = default;
+  meshCache &operator=(meshCache &&) = default;
+
+  // nullopt when the file is missing, from another version or for another source
+  static std::optional<meshCache> open(const std::string &cachePath, const sourceKey &key) {
+    BROC_ZONE("open mesh cache");
+    meshCache result;
+    if (!result.file_.open(cachePath)) {
+      return std::nullopt;
+    }
+    result.data_ = result.file_.data();
+    result.size_ = result.file_.size();
+    if (!result.valid() || !result.matches(key)) {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  static meshCache build(const sourceKey &key, const math::coreMesh &mesh,
+                         const math::Curvatures &curvatures) {
+    BROC_ZONE("build mesh cache");
+    header h{};
+    std::memcpy(h.magic, magic, sizeof(h.magic));
+    h.version = version;
+    h.pathBytes = static_cast<u32>(key.path.size());
+    h.sourceSize = key.size;
+    h.sourceMtime = key.mtime;
+    h.nVertices = mesh.nVertices();
+    h.nIndices = mesh.indices.size();
+    h.nRingVertices = mesh.ring.vertices.size();
+    u64 offset = align(sizeof(header) + h.pathBytes);
+    for (u32 s = 0; s < nSections; ++s) {
+      h.offsets[s] = offset;
+      offset = align(offset + sectionBytes(h, static_cast<section>(s)));
+    }
+    h.fileSize = offset;
+
+    meshCache result;
+    result.image_.assign(h.fileSize, 0);
+    u8 *out = result.image_.data();
+    std::memcpy(out, &h, sizeof(h));
+    std::memcpy(out + sizeof(h), key.path.data(), h.pathBytes);
+    auto put = [&](section s, const void *src) {
+      std::memcpy(out + h.offsets[s], src, sectionBytes(h, s));
+    };
+    put(positions, mesh.positions.data());
+    put(normals, mesh.normals.data());
+    put(indices, mesh.indices.data());
+    put(ringOffsets, mesh.ring.offsets.data());
+    put(ringVertices, mesh.ring.vertices.data());
+    put(cornerOffsets, mesh.corners.offsets.data());
+    put(corners, mesh.corners.corners.data());
+    put(opposite, mesh.opposite.data());
+    put(mean, curvatures.mean.data());
+    put(gaussian, curvatures.gaussian.data());
+    put(k1, curvatures.k1.data());
+    put(k2, curvatures.k2.data());
+    result.data_ = out;
+    result.size_ = result.image_.size();
+    return result;
+  }
+
+  // written next to the final name and renamed, a crash never leaves half a cache behind
+  bool write(const std::string &cachePath) const {
+    BROC_ZONE("write mesh cache");
+    std::string tmpPath = cachePath + ".tmp";
+    {
+      std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char *>(data_), static_cast<std::streamsize>(size_));
+      out.close();
+      if (!out) {
+        return false;
+      }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, cachePath, ec);
+    if (ec) {
+      std::filesystem::remove(tmpPath, ec);
+      return false;
+    }
+    return true;
+  }
+
+  size_t nVertices() const { return head().nVertices; }
+
+  std::span<const float> curvatureView(section s) const { return view<float>(s); }
+
+  // A straight copy of every array, no adjacency is rebuilt. The rest of the tree reads owning
+  // vectors and the viewer centres the positions in place, so a warm start is not zero copy:
+  // 40-60 ms per million vertices from the page cache (cache/core in the bench), a small part
+  // of the start next to the bvh build.
+  math::coreMesh core() const {
+    BROC_ZONE("core from cache");
+    math::coreMesh mesh;
+    copy(positions, mesh.positions);
+    copy(normals, mesh.normals);
+    copy(indices, mesh.indices);
+    copy(ringOffsets, mesh.ring.offsets);
+    copy(ringVertices, mesh.ring.vertices);
+    copy(cornerOffsets, mesh.corners.offsets);
+    copy(corners, mesh.corners.corners);
+    copy(opposite, mesh.opposite);
+    return mesh;
+  }
+
+private:
+  static constexpr char magic[8] = {'B', 'R', 'O', 'C', 'M', 'S', 'H', '\0'};
+
+  struct header {
+    char magic[8];
+    u32 version;
+    u32 pathBytes; // source path, right after the header
+    u64 sourceSize;
+    i64 sourceMtime;
+    u64 nVertices;
+    u64 nIndices;
+    u64 nRingVertices;
+    u64 fileSize;
+    u64 offsets[nSections];
+  };
+
+  meshCache() = default;
+
+  static u64 align(u64 offset) { return (offset + 63) & ~u64(63); }
+
+  static u64 sectionBytes(const header &h, section s) {
+    switch (s) {
+    case positions:
+    case normals:
+      return h.nVertices * sizeof(glm::vec3);
+    case indices:
+    case corners:
+    case opposite:
+      return h.nIndices * sizeof(u32);
+    case ringOffsets:
+    case cornerOffsets:
+      return (h.nVertices + 1) * sizeof(u32);
+    case ringVertices:
+      return h.nRingVertices * sizeof(u32);
+    default:
+      return h.nVertices * sizeof(float);
+    }
+  }
+
+  const header &head() const { return *reinterpret_cast<const header *>(data_); }
+
+  template <typename T> std::span<const T> view(section s) const {
+    const header &h = head();
+    return {reinterpret_cast<const T *>(data_ + h.offsets[s]), sectionBytes(h, s) / sizeof(T)};
+  }
+
+  template <typename T> void copy(section s, std::vector<T> &out) const {
+    std::span<const T> in = view<T>(s);
+    out.assign(in.begin(), in.end());
+  }
+
+  // the header and every section lie inside the file, sizes fit the 32-bit indices
+  bool valid() const {
+    if (size_ < sizeof(header)) {
+      return false;
+    }
+    const header &h = head();
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+        h.fileSize != size_ || sizeof(header) + u64(h.pathBytes) > size_ ||
+        h.nVertices >= 0xffffffffu || h.nIndices > 0xffffffffu || h.nRingVertices > 0xffffffffu) {
+      return false;
+    }
+    for (u32 s = 0; s < nSections; ++s) {
+      u64 offset = h.offsets[s];
+      u64 bytes = sectionBytes(h, static_cast<section>(s));
+      if (offset % 64 != 0 || offset > size_ || bytes > size_ - offset) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool matches(const sourceKey &key) const {
+    const header &h = head();
+    return h.sourceSize == key.size && h.sourceMtime == key.mtime &&
+           h.pathBytes == key.path.size() &&
+           std::memcmp(data_ + sizeof(header), key.path.data(), key.path.size()) == 0;
+  }
+
+  mappedFile file_;
+  std::vector<u8> image_;
+  const u8 *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace cache
+} // namespace brocseg
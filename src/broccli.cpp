@@ -0,0 +1,322 @@
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// broc
+#include "broccommon.h"
+#include "brocflow.h"
+#include "brocmesh.h"
+#include "brocprof.h"
+
+// Headless segmentation of one mesh, no window and no GL.
+//
+// usage: brocseg_cli <mesh> [options]
+//   -s <label>:<v>[,<v>...]  seed vertices for a label, repeatable
+//   -f <file>                seed file, one "<label> <v> [<v>...]" line per label, # comments
+//   -p <percentile>          curvature percentile, default 0.9
+//   -a <ek|pr|bk|cs>         max-flow backend for two single-seed labels, default bk
+//   -t <i32|i64|float|double> capacity type of that cut, default i32
+//   -c <rings>               closing applied to a cut between two labels, default 1
+//   -m <vertices>            smaller islands and holes of that cut are removed, default 32
+//   -b <rings>               cut two labels coarse to fine, re-solving a band this wide per level
+//   -e <cut|walker>          segmentation engine, default cut
+//   -o <file>                per-vertex labels, one per line, default <mesh>.labels
+//
+// Two labels are split by a single min cut between their seed sets, as a pair of clicks or brush
+// strokes in the viewer would be. More labels go through alpha-expansion. With -e walker any
+// number of labels goes through the random walker instead. An option the chosen path does not
+// use is an error. Logs go to stderr, stdout is one tab separated timing line:
+// timing <mesh> <vertices> <load s> <curvature s> <segmentation s> <total s>
+
+namespace {
+
+using namespace brocseg;
+
+void usage() {
+  std::fprintf(stderr, "usage: brocseg_cli <mesh> [-s label:v,v,...] [-f seedfile] "
+                       "[-p percentile] [-a ek|pr|bk|cs] [-t i32|i64|float|double] "
+                       "[-c rings] [-m vertices] [-b rings] [-e cut|walker] [-o labels]\n");
+}
+
+void addSeed(std::vector<std::vector<u32>> &seeds, size_t label, u32 v) {
+  if (seeds.size() <= label) {
+    seeds.resize(label + 1);
+  }
+  seeds[label].push_back(v);
+}
+
+bool parseSeedArg(const std::string &arg, std::vector<std::vector<u32>> &seeds) {
+  size_t colon = arg.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  size_t label = std::stoul(arg.substr(0, colon));
+  std::stringstream vertices(arg.substr(colon + 1));
+  std::string v;
+  while (std::getline(vertices, v, ',')) {
+    addSeed(seeds, label, static_cast<u32>(std::stoul(v)));
+  }
+  return true;
+}
+
+bool readSeedFile(const std::string &path, std::vector<std::vector<u32>> &seeds) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::stringstream ss(line);
+    size_t label;
+    if (!(ss >> label)) {
+      continue;
+    }
+    u32 v;
+    while (ss >> v) {
+      addSeed(seeds, label, v);
+    }
+  }
+  return true;
+}
+
+bool parseMaxflow(const std::string &name, math::maxflow &algorithm) {
+  if (name == "ek" || name == math::maxflowName(math::maxflow::edmondsKarp)) {
+    algorithm = math::maxflow::edmondsKarp;
+  } else if (name == "pr" || name == math::maxflowName(math::maxflow::pushRelabel)) {
+    algorithm = math::maxflow::pushRelabel;
+  } else if (name == "bk" || name == math::maxflowName(math::maxflow::boykovKolmogorov)) {
+    algorithm = math::maxflow::boykovKolmogorov;
+  } else if (name == "cs" || name == math::maxflowName(math::maxflow::capacityScaling)) {
+    algorithm = math::maxflow::capacityScaling;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+enum class capacityType { int32, int64, float32, float64 };
+
+bool parseCapacityType(const std::string &name, capacityType &type) {
+  if (name == "i32") {
+    type = capacityType::int32;
+  } else if (name == "i64") {
+    type = capacityType::int64;
+  } else if (name == "float") {
+    type = capacityType::float32;
+  } else if (name == "double") {
+    type = capacityType::float64;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// the single-seed cut on a network of its own with Cap capacities
+template <typename Cap>
+std::vector<size_t> cutWith(const math::OneRing &ring, u32 source, u32 sink,
+                            const std::vector<float> &energy, math::maxflow algorithm,
+                            const region::cleanupOptions &cleanup) {
+  math::basicFlownet<Cap> g = flownetFromRing<Cap>(ring);
+  return colorByBorders(g, ring, source, sink, energy, algorithm, cleanup);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  std::string meshName = argv[1];
+  std::string outName = meshName + ".labels";
+  float percentile = 0.9f;
+  math::maxflow algorithm = math::maxflow::boykovKolmogorov;
+  capacityType capacity = capacityType::int32;
+  region::cleanupOptions cleanup;
+  // band of the coarse to fine cut, the full mesh is cut when negative
+  int bandRings = -1;
+  bool randomWalk = false;
+  // given on the command line, checked against the path the seeds take
+  bool algorithmSet = false;
+  bool cleanupSet = false;
+  std::vector<std::vector<u32>> labelSeeds;
+  for (int i = 2; i < argc; ++i) {
+    const char *opt = argv[i];
+    if (i + 1 >= argc || opt[0] != '-' || std::strlen(opt) != 2) {
+      usage();
+      return 2;
+    }
+    std::string value = argv[++i];
+    bool ok = true;
+    try {
+      switch (opt[1]) {
+      case 's':
+        ok = parseSeedArg(value, labelSeeds);
+        break;
+      case 'f':
+        ok = readSeedFile(value, labelSeeds);
+        break;
+      case 'p':
+        percentile = std::stof(value);
+        ok = percentile > 0.0f && percentile <= 1.0f;
+        break;
+      case 'a':
+        ok = parseMaxflow(value, algorithm);
+        algorithmSet = true;
+        break;
+      case 't':
+        ok = parseCapacityType(value, capacity);
+        algorithmSet = true;
+        break;
+      case 'c':
+        cleanup.closeIterations = static_cast<u32>(std::stoul(value));
+        cleanupSet = true;
+        break;
+      case 'm':
+        cleanup.minComponent = static_cast<u32>(std::stoul(value));
+        cleanupSet = true;
+        break;
+      case 'b':
+        bandRings = std::stoi(value);
+        ok = bandRings >= 0;
+        break;
+      case 'e':
+        randomWalk = value == "walker";
+        ok = randomWalk || value == "cut";
+        break;
+      case 'o':
+        outName = value;
+        break;
+      default:
+        ok = false;
+      }
+    } catch (const std::exception &) {
+      // stoul / stof on something that is not a number
+      ok = false;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "bad value for %s: %s\n", opt, value.c_str());
+      return 2;
+    }
+  }
+
+  // labels without seeds are left out, as in the viewer
+  std::vector<std::vector<u32>> seeds;
+  std::vector<u32> labelIds;
+  for (size_t label = 0; label < labelSeeds.size(); ++label) {
+    if (!labelSeeds[label].empty()) {
+      seeds.push_back(labelSeeds[label]);
+      labelIds.push_back(static_cast<u32>(label));
+    }
+  }
+  if (seeds.size() < 2) {
+    std::fprintf(stderr, "need seeds for at least two labels\n");
+    return 2;
+  }
+  const bool twoLabelCut = !randomWalk && seeds.size() == 2;
+  const bool singleCut =
+      twoLabelCut && bandRings < 0 && seeds[0].size() == 1 && seeds[1].size() == 1;
+  if ((cleanupSet || bandRings >= 0) && !twoLabelCut) {
+    std::fprintf(stderr, "-c, -m and -b only apply to a cut between two labels\n");
+    return 2;
+  }
+  if (algorithmSet && !singleCut) {
+    std::fprintf(stderr, "-a and -t only apply to a full cut between two single seeds\n");
+    return 2;
+  }
+
+  prof::watch totalWatch;
+  prof::watch loadWatch;
+  math::coreMesh mesh = loadCoreMesh(meshName);
+  float loadSeconds = loadWatch.seconds();
+  for (const std::vector<u32> &labelSeed : seeds) {
+    for (u32 v : labelSeed) {
+      if (v >= mesh.nVertices()) {
+        std::fprintf(stderr, "seed %u out of range, mesh has %zu vertices\n", v,
+                     mesh.nVertices());
+        return 2;
+      }
+    }
+  }
+
+  prof::watch curvatureWatch;
+  std::vector<float> rawCurvatures = computePerVertexMeanCurvature(mesh);
+  std::vector<float> energy =
+      energyFromCurvatures(rawCurvatures, math::percentileCache{rawCurvatures}, percentile);
+  float curvatureSeconds = curvatureWatch.seconds();
+
+  prof::watch segmentWatch;
+  math::flownet g = flownetFromRing(mesh.ring);
+  std::vector<u32> labels;
+  if (randomWalk) {
+    math::randomWalker walker{mesh};
+    walker.setEnergy(mesh.ring, energy);
+    labels = segmentRandomWalker(walker, mesh.ring, seeds);
+    for (u32 &label : labels) {
+      label = labelIds[label];
+    }
+  } else if (seeds.size() == 2) {
+    labels.assign(mesh.nVertices(), labelIds[1]);
+    if (bandRings >= 0) {
+      math::multiscaleCut pyramid{mesh.ring, mesh.positions, cutCapacities(g, energy)};
+      pyramid.bandRings = static_cast<u32>(bandRings);
+      mem::arena arena;
+      for (u32 v : colorByBorders(pyramid, mesh.ring, seeds[0], seeds[1], arena, cleanup)) {
+        labels[v] = labelIds[0];
+      }
+    } else if (seeds[0].size() > 1 || seeds[1].size() > 1) {
+      // seed sets need the terminal links of a session, which is boykov-kolmogorov
+      math::cutSession session{std::move(g)};
+      for (u32 v : colorByBorders(session, mesh.ring, seeds[0], seeds[1], energy, cleanup)) {
+        labels[v] = labelIds[0];
+      }
+    } else {
+      const u32 source = seeds[0][0];
+      const u32 sink = seeds[1][0];
+      std::vector<size_t> cut;
+      switch (capacity) {
+      case capacityType::int32:
+        cut = colorByBorders(g, mesh.ring, source, sink, energy, algorithm, cleanup);
+        break;
+      case capacityType::int64:
+        cut = cutWith<i64>(mesh.ring, source, sink, energy, algorithm, cleanup);
+        break;
+      case capacityType::float32:
+        cut = cutWith<float>(mesh.ring, source, sink, energy, algorithm, cleanup);
+        break;
+      case capacityType::float64:
+        cut = cutWith<double>(mesh.ring, source, sink, energy, algorithm, cleanup);
+        break;
+      }
+      for (size_t v : cut) {
+        labels[v] = labelIds[0];
+      }
+    }
+  } else {
+    labels = segmentMultiLabel(g, energy, seeds);
+    for (u32 &label : labels) {
+      label = labelIds[label];
+    }
+  }
+  float segmentSeconds = segmentWatch.seconds();
+
+  std::ofstream out(outName);
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", outName.c_str());
+    return 1;
+  }
+  for (u32 label : labels) {
+    out << label << "\n";
+  }
+  out.close();
+
+  std::printf("timing\t%s\t%zu\t%.6f\t%.6f\t%.6f\t%.6f\n", meshName.c_str(), mesh.nVertices(),
+              loadSeconds, curvatureSeconds, segmentSeconds, totalWatch.seconds());
+  return 0;
+}
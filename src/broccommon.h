@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
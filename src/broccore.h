@@ -0,0 +1,165 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "broccommon.h"
+#include "broccurv.h"
+#include "brocmath.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace math {
+
+// Halfedge h = 3 * f + k runs from indices[h] to indices[nextHalfedge(h)], so halfedges and
+// corners share their numbering.
+constexpr u32 noHalfedge = 0xffffffffu;
+
+inline u32 nextHalfedge(u32 h) { return h - h % 3 + (h + 1) % 3; }
+inline u32 prevHalfedge(u32 h) { return h - h % 3 + (h + 2) % 3; }
+
+// The halfedge running the other way along the same edge, noHalfedge on the boundary. Where
+// more than two faces share an edge the first one found pairs up.
+inline std::vector<u32> oppositeHalfedges(const std::vector<u32> &indices,
+                                          const VertexCorners &vc) {
+  BROC_ZONE("oppositeHalfedges");
+  std::vector<u32> opposite(indices.size(), noHalfedge);
+  par::forChunks(indices.size(), [&](size_t beg, size_t end) {
+    for (u32 h = static_cast<u32>(beg); h < end; ++h) {
+      u32 from = indices[h];
+      u32 to = indices[nextHalfedge(h)];
+      for (u32 i = vc.offsets[to]; i < vc.offsets[to + 1]; ++i) {
+        u32 g = vc.corners[i];
+        if (indices[nextHalfedge(g)] == from) {
+          opposite[h] = g;
+          break;
+        }
+      }
+    }
+  });
+  return opposite;
+}
+
+// Same ring order as oneRingFromFaces, walked over opposite halfedges instead of searched:
+// from the corner of v in one face, the next face around v holds the opposite of the
+// halfedge coming into v. Boundary fans start where nothing leads in.
+inline OneRing oneRingFromHalfedges(size_t nVertices, const std::vector<u32> &indices,
+                                    const VertexCorners &vc, const std::vector<u32> &opposite) {
+  BROC_ZONE("oneRingFromHalfedges");
+  OneRing ring;
+  ring.offsets.assign(nVertices + 1, 0);
+  // rings are built per chunk, counted, then copied to their final place
+  const size_t nChunks = std::max<size_t>(1, std::min(par::nThreads(), nVertices / 1024));
+  std::vector<std::vector<u32>> chunkRings(nChunks);
+  par::forChunks(nChunks, [&](size_t chunkBeg, size_t chunkEnd) {
+    std::vector<u32> visited;
+    for (size_t c = chunkBeg; c < chunkEnd; ++c) {
+      std::vector<u32> &out = chunkRings[c];
+      for (size_t v = nVertices * c / nChunks; v < nVertices * (c + 1) / nChunks; ++v) {
+        const u32 *corners = vc.corners.data() + vc.offsets[v];
+        const u32 nCorners = vc.offsets[v + 1] - vc.offsets[v];
+        size_t ringBeg = out.size();
+        auto emit = [&](u32 u) {
+          if (std::find(out.begin() + ringBeg, out.end(), u) == out.end()) {
+            out.push_back(u);
+          }
+        };
+        // the corner of v in the face across an incoming halfedge, if v is its tail
+        auto next = [&](u32 corner) {
+          u32 h = opposite[prevHalfedge(corner)];
+          return (h != noHalfedge && indices[h] == v) ? h : noHalfedge;
+        };
+        visited.clear();
+        u32 start = nCorners ? corners[0] : noHalfedge;
+        for (u32 i = 0; i < nCorners; ++i) {
+          u32 h = opposite[corners[i]];
+          if (h == noHalfedge || indices[nextHalfedge(h)] != v) {
+            start = corners[i];
+            break;
+          }
+        }
+        while (start != noHalfedge) {
+          emit(indices[nextHalfedge(start)]);
+          for (u32 corner = start; corner != noHalfedge;) {
+            visited.push_back(corner);
+            emit(indices[prevHalfedge(corner)]);
+            corner = next(corner);
+            if (std::find(visited.begin(), visited.end(), corner) != visited.end()) {
+              break;
+            }
+          }
+          // non-manifold leftovers, one more fan each
+          start = noHalfedge;
+          for (u32 i = 0; i < nCorners; ++i) {
+            if (std::find(visited.begin(), visited.end(), corners[i]) == visited.end()) {
+              start = corners[i];
+              break;
+            }
+          }
+        }
+        ring.offsets[v + 1] = static_cast<u32>(out.size() - ringBeg);
+      }
+    }
+  }, 1);
+  for (size_t v = 0; v < nVertices; ++v) {
+    ring.offsets[v + 1] += ring.offsets[v];
+  }
+  ring.vertices.resize(ring.offsets[nVertices]);
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      std::copy(chunkRings[c].begin(), chunkRings[c].end(),
+                ring.vertices.begin() + ring.offsets[nVertices * c / nChunks]);
+    }
+  }, 1);
+  return ring;
+}
+
+// The one mesh curvature, cuts, picking and rendering all read: positions and normals in
+// their own arrays, flat triangles, vertex-vertex and vertex-face CSR adjacency and the
+// opposite halfedge of every halfedge.
+struct coreMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<u32> indices;
+  OneRing ring;
+  VertexCorners corners;
+  std::vector<u32> opposite;
+
+  size_t nVertices() const { return positions.size(); }
+  size_t nFaces() const { return indices.size() / 3; }
+};
+
+// adjacency for the given triangles
+inline coreMesh coreMeshFromTriangles(std::vector<glm::vec3> positions,
+                                      std::vector<glm::vec3> normals, std::vector<u32> indices) {
+  BROC_ZONE("coreMesh");
+  coreMesh mesh;
+  mesh.positions = std::move(positions);
+  mesh.normals = std::move(normals);
+  mesh.indices = std::move(indices);
+  mesh.corners = vertexCornersFromFaces(mesh.nVertices(), mesh.indices);
+  mesh.opposite = oppositeHalfedges(mesh.indices, mesh.corners);
+  mesh.ring = oneRingFromHalfedges(mesh.nVertices(), mesh.indices, mesh.corners, mesh.opposite);
+  return mesh;
+}
+
+inline Curvatures computeCurvatures(const coreMesh &mesh) {
+  return computeCurvatures(mesh.positions, mesh.normals, mesh.indices, mesh.corners);
+}
+
+// centres the mesh on the origin and scales its longest side to 1
+inline void translateToOrigin(coreMesh &mesh) {
+  BBox box;
+  for (const glm::vec3 &p : mesh.positions) {
+    box.addPoint(p);
+  }
+  glm::vec3 centre = (box.maxp + box.minp) / 2.0f;
+  glm::vec3 diag = box.maxp - box.minp;
+  float scale = std::max(diag[0], std::max(diag[1], diag[2]));
+  for (glm::vec3 &p : mesh.positions) {
+    p = (p - centre) / scale;
+  }
+}
+
+} // namespace math
+} // namespace brocseg
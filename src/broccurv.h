@@ -0,0 +1,192 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "broccommon.h"
+#include "brocmath.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+#include "brocsimd.h"
+
+namespace brocseg {
+namespace math {
+
+// Compressed one-ring adjacency: the neighbours of v, in ring order, are
+// vertices[offsets[v]] .. vertices[offsets[v + 1] - 1].
+struct OneRing {
+  std::vector<u32> offsets;
+  std::vector<u32> vertices;
+
+  size_t nVertices() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  u32 valence(u32 v) const { return offsets[v + 1] - offsets[v]; }
+};
+
+struct VertexCurvature {
+  float mean;
+  float gaussian;
+  float k1;
+  float k2;
+};
+
+struct Curvatures {
+  std::vector<float> mean;
+  std::vector<float> gaussian;
+  std::vector<float> k1;
+  std::vector<float> k2;
+};
+
+// Faces around every vertex as corners 3 * f + k, so indices[corner] is the vertex itself.
+struct VertexCorners {
+  std::vector<u32> offsets;
+  std::vector<u32> corners;
+
+  size_t nVertices() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+};
+
+inline VertexCorners vertexCornersFromFaces(size_t nVertices, const std::vector<u32> &indices) {
+  VertexCorners result;
+  result.offsets.assign(nVertices + 1, 0);
+  for (u32 v : indices) {
+    ++result.offsets[v + 1];
+  }
+  for (size_t v = 0; v < nVertices; ++v) {
+    result.offsets[v + 1] += result.offsets[v];
+  }
+  result.corners.resize(indices.size());
+  std::vector<u32> fill(result.offsets.begin(), result.offsets.end() - 1);
+  for (u32 corner = 0; corner < indices.size(); ++corner) {
+    result.corners[fill[indices[corner]]++] = corner;
+  }
+  return result;
+}
+
+// One-ring from triangles alone, neighbours in fan order like OpenMesh's vv circulator.
+// A boundary fan starts at the neighbour no face leads into, non-manifold leftovers go last.
+inline OneRing oneRingFromFaces(size_t nVertices, const std::vector<u32> &indices) {
+  VertexCorners vc = vertexCornersFromFaces(nVertices, indices);
+  OneRing ring;
+  ring.offsets.assign(nVertices + 1, 0);
+  ring.vertices.reserve(indices.size() + indices.size() / 8);
+  // (q, r) per incident face: going around v, r follows q
+  std::vector<std::pair<u32, u32>> fan;
+  std::vector<u8> used;
+  for (size_t v = 0; v < nVertices; ++v) {
+    fan.clear();
+    for (u32 i = vc.offsets[v]; i < vc.offsets[v + 1]; ++i) {
+      u32 f = vc.corners[i] / 3;
+      u32 k = vc.corners[i] % 3;
+      fan.push_back({indices[3 * f + (k + 1) % 3], indices[3 * f + (k + 2) % 3]});
+    }
+    used.assign(fan.size(), 0);
+    size_t ringBeg = ring.vertices.size();
+    auto emit = [&](u32 u) {
+      if (std::find(ring.vertices.begin() + ringBeg, ring.vertices.end(), u) ==
+          ring.vertices.end()) {
+        ring.vertices.push_back(u);
+      }
+    };
+    size_t start = 0;
+    for (size_t j = 0; j < fan.size(); ++j) {
+      bool hasPrev = std::any_of(fan.begin(), fan.end(),
+                                 [&](const auto &edge) { return edge.second == fan[j].first; });
+      if (!hasPrev) {
+        start = j;
+        break;
+      }
+    }
+    for (size_t first = start; first < fan.size();) {
+      u32 curr = fan[first].first;
+      emit(curr);
+      while (true) {
+        size_t j = 0;
+        while (j < fan.size() && (used[j] || fan[j].first != curr)) {
+          ++j;
+        }
+        if (j == fan.size()) {
+          break;
+        }
+        used[j] = 1;
+        curr = fan[j].second;
+        emit(curr);
+      }
+      first = std::find(used.begin(), used.end(), 0) - used.begin();
+    }
+    ring.offsets[v + 1] = static_cast<u32>(ring.vertices.size());
+  }
+  return ring;
+}
+
+// Mean, Gaussian and principal curvatures of p from the precomputed corners of its faces.
+// Same formulas as meanCurvature / gaussianCurvature / mixedVoronoiCellArea, only summed per
+// face: edge (p, q) of face (p, q, r) gets the cotangent at r.
+inline VertexCurvature vertexCurvature(const glm::vec3 &p, const glm::vec3 &n,
+                                       const glm::vec3 *positions, const u32 *indices,
+                                       const FaceGeometry &faces, const u32 *corners,
+                                       u32 nCorners) {
+  float area = 0.0f;
+  float sumAngles = 0.0f;
+  glm::vec3 meanCurvatureNormal = glm::vec3(0.0f);
+  for (u32 j = 0; j < nCorners; ++j) {
+    u32 f = corners[j] / 3;
+    u32 k = corners[j] % 3;
+    u32 k1 = (k + 1) % 3;
+    u32 k2 = (k + 2) % 3;
+    const glm::vec3 &q = positions[indices[3 * f + k1]];
+    const glm::vec3 &r = positions[indices[3 * f + k2]];
+    sumAngles += faces.angle[k][f];
+    area += faces.mixed[k][f];
+    meanCurvatureNormal += faces.cot[k2][f] * (q - p) + faces.cot[k1][f] * (r - p);
+  }
+
+  VertexCurvature result;
+  if (area <= EPS) {
+    result.mean = result.gaussian = std::numeric_limits<float>::max();
+    result.k1 = result.k2 = std::numeric_limits<float>::max();
+    return result;
+  }
+  meanCurvatureNormal *= 1.0f / (2.0f * area);
+  int meanCurvatureSign = glm::dot(n, -meanCurvatureNormal) >= 0 ? 1 : -1;
+  result.mean = meanCurvatureSign * glm::length(meanCurvatureNormal) / 2.0f;
+  result.gaussian = (2.0f * pi - sumAngles) / area;
+  float discriminant = std::sqrt(std::max(0.0f, result.mean * result.mean - result.gaussian));
+  result.k1 = result.mean + discriminant;
+  result.k2 = result.mean - discriminant;
+  return result;
+}
+
+inline Curvatures computeCurvatures(const std::vector<glm::vec3> &positions,
+                                    const std::vector<glm::vec3> &normals,
+                                    const std::vector<u32> &indices, const VertexCorners &vc) {
+  size_t n = positions.size();
+  FaceGeometry faces = computeFaceGeometry(positions, indices);
+  Curvatures result;
+  result.mean.resize(n);
+  result.gaussian.resize(n);
+  result.k1.resize(n);
+  result.k2.resize(n);
+  par::forChunks(n, [&](size_t beg, size_t end) {
+    BROC_ZONE("vertexCurvature");
+    for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+      VertexCurvature c =
+          vertexCurvature(positions[v], normals[v], positions.data(), indices.data(), faces,
+                          vc.corners.data() + vc.offsets[v], vc.offsets[v + 1] - vc.offsets[v]);
+      result.mean[v] = c.mean;
+      result.gaussian[v] = c.gaussian;
+      result.k1[v] = c.k1;
+      result.k2[v] = c.k2;
+    }
+  });
+  return result;
+}
+
+inline Curvatures computeCurvatures(const std::vector<glm::vec3> &positions,
+                                    const std::vector<glm::vec3> &normals,
+                                    const std::vector<u32> &indices) {
+  return computeCurvatures(positions, normals, indices,
+                           vertexCornersFromFaces(positions.size(), indices));
+}
+
+} // namespace math
+} // namespace brocseg
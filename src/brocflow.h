@@ -0,0 +1,919 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "brocarena.h"
+#include "broccommon.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace math {
+
+enum class maxflow { edmondsKarp, pushRelabel, boykovKolmogorov, capacityScaling };
+
+inline const char *maxflowName(maxflow algorithm) {
+  switch (algorithm) {
+  case maxflow::edmondsKarp:
+    return "edmonds-karp";
+  case maxflow::pushRelabel:
+    return "push-relabel";
+  case maxflow::boykovKolmogorov:
+    return "boykov-kolmogorov";
+  case maxflow::capacityScaling:
+    return "capacity-scaling";
+  }
+  return "unknown";
+}
+
+// What the solvers need to know about a capacity type. Flow values and terminal links are
+// summed in i64 for integer capacities and in the capacity type itself for floating point ones,
+// so pushing all of an excess or a terminal link leaves exactly zero behind.
+template <typename Cap> struct capacityTraits {
+  static_assert(std::is_signed_v<Cap>, "capacities must be signed");
+  using flowType = std::conditional_t<std::is_integral_v<Cap>, i64, Cap>;
+
+  static constexpr Cap maximum = std::numeric_limits<Cap>::max();
+  // largest capacity worth setting: r(u -> v) + r(v -> u) stays constant under pushes, so two
+  // twins at this value never overflow
+  static constexpr Cap infinite = maximum / 2;
+  // a terminal link no cut can saturate; floating point gets a real infinity, which survives
+  // any finite change but cannot be taken back by subtracting it
+  static constexpr flowType infiniteTerminal =
+      std::is_integral_v<Cap> ? static_cast<flowType>(std::numeric_limits<i64>::max() / 4)
+                              : std::numeric_limits<flowType>::infinity();
+};
+
+// Flow network over a symmetric graph stored as compressed rows: out-edges of vertex v are
+// [rowBeg_[v], rowBeg_[v + 1]), edge e points to head_[e], reverse_[e] is its twin head_[e] -> v.
+// Memory is O(V + E), capacities live in a flat array indexed by edge. Cap is any signed
+// arithmetic type: float and double take edge weights as they are, without scaling to integers.
+template <typename Cap> class basicFlownet {
+public:
+  using capacity = Cap;
+  using flowType = typename capacityTraits<Cap>::flowType;
+
+  static constexpr u32 noEdge = std::numeric_limits<u32>::max();
+  static constexpr Cap infiniteCapacity = capacityTraits<Cap>::infinite;
+
+  basicFlownet() = default;
+  // every edge u -> v must have a matching v -> u (zero capacity is fine)
+  basicFlownet(std::vector<u32> rowBeg, std::vector<u32> head)
+      : rowBeg_(std::move(rowBeg)), head_(std::move(head)), reverse_(head_.size(), noEdge),
+        capacity_(head_.size(), 0) {
+    for (u32 v = 0; v < nVertices(); ++v) {
+      for (u32 e = rowBeg_[v]; e < rowBeg_[v + 1]; ++e) {
+        u32 to = head_[e];
+        for (u32 r = rowBeg_[to]; r < rowBeg_[to + 1]; ++r) {
+          if (head_[r] == v) {
+            reverse_[e] = r;
+            break;
+          }
+        }
+        if (reverse_[e] == noEdge) {
+          throw std::invalid_argument("flownet: adjacency is not symmetric");
+        }
+      }
+    }
+  }
+
+  size_t nVertices() const { return rowBeg_.empty() ? 0 : rowBeg_.size() - 1; }
+  size_t nEdges() const { return head_.size(); }
+  u32 tail(u32 e) const { return head_[reverse_[e]]; }
+
+  // sends d units along e; the twin saturates instead of overflowing when capacities above
+  // infiniteCapacity were set
+  void push(u32 e, Cap d) {
+    residual_[e] -= d;
+    const Cap maxCapacity = capacityTraits<Cap>::maximum;
+    Cap &back = residual_[reverse_[e]];
+    back = (back > maxCapacity - d) ? maxCapacity : back + d;
+  }
+
+  // returns indices of vertices in S-part of the flow network
+  std::vector<size_t> mincut(size_t s, size_t t,
+                             maxflow algorithm = maxflow::boykovKolmogorov);
+
+  // vertices reachable from the roots through edges with residual capacity left
+  std::vector<size_t> reachable(const std::vector<u32> &roots) const {
+    std::vector<u8> visited(nVertices(), 0);
+    std::vector<u32> queue(nVertices());
+    size_t count = reach(roots, visited, queue);
+    std::vector<size_t> result(queue.begin(), queue.begin() + count);
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  // same, with the scratch and the result in the arena
+  std::span<u32> reachable(std::span<const u32> roots, mem::arena &arena) const {
+    std::span<u32> queue = arena.alloc<u32>(nVertices());
+    size_t count = reach(roots, arena.alloc<u8>(nVertices(), 0), queue);
+    std::sort(queue.begin(), queue.begin() + count);
+    return queue.first(count);
+  }
+
+  std::vector<u32> rowBeg_;
+  std::vector<u32> head_;
+  std::vector<u32> reverse_;
+  std::vector<Cap> capacity_;
+  std::vector<Cap> residual_;
+  flowType flow_ = 0;
+
+private:
+  // breadth first from the roots, visited zeroed, queue big enough for every vertex; returns
+  // how many vertices the queue ended up with
+  size_t reach(std::span<const u32> roots, std::span<u8> visited, std::span<u32> queue) const {
+    size_t tail = 0;
+    for (u32 root : roots) {
+      if (!visited[root]) {
+        visited[root] = 1;
+        queue[tail++] = root;
+      }
+    }
+    for (size_t head = 0; head < tail; ++head) {
+      u32 curr = queue[head];
+      for (u32 e = rowBeg_[curr]; e < rowBeg_[curr + 1]; ++e) {
+        u32 next = head_[e];
+        if (!visited[next] && residual_[e] > 0) {
+          visited[next] = 1;
+          queue[tail++] = next;
+        }
+      }
+    }
+    return tail;
+  }
+};
+
+using flownet = basicFlownet<i32>;
+
+// Shortest augmenting paths, one BFS from the source per path.
+template <typename Cap> class edmondsKarp {
+public:
+  using net = basicFlownet<Cap>;
+  using flowType = typename net::flowType;
+
+  flowType run(net &g, u32 s, u32 t) { return run(g, s, t, 0); }
+
+  // only through edges with at least minResidual left, any positive residual for 0
+  flowType run(net &g, u32 s, u32 t, Cap minResidual) {
+    pathFlow_.resize(g.nVertices());
+    parentEdge_.resize(g.nVertices());
+    queue_.reserve(g.nVertices());
+    flowType flow = 0;
+    Cap newFlow;
+    while ((newFlow = bfs(g, s, t, minResidual)) != 0) {
+      flow += newFlow;
+      for (u32 curr = t; curr != s;) {
+        u32 e = parentEdge_[curr];
+        g.push(e, newFlow);
+        curr = g.tail(e);
+      }
+    }
+    return flow;
+  }
+
+private:
+  // augmenting path search in the residual graph, parentEdge_[v] is the edge that reached v
+  Cap bfs(const net &g, u32 s, u32 t, Cap minResidual) {
+    std::fill(parentEdge_.begin(), parentEdge_.end(), net::noEdge);
+    queue_.clear();
+    queue_.push_back(s);
+    pathFlow_[s] = capacityTraits<Cap>::maximum;
+    for (size_t head = 0; head < queue_.size(); ++head) {
+      u32 curr = queue_[head];
+      for (u32 e = g.rowBeg_[curr]; e < g.rowBeg_[curr + 1]; ++e) {
+        u32 next = g.head_[e];
+        Cap r = g.residual_[e];
+        if (next != s && parentEdge_[next] == net::noEdge && r > 0 && r >= minResidual) {
+          parentEdge_[next] = e;
+          pathFlow_[next] = std::min(pathFlow_[curr], r);
+          if (next == t)
+            return pathFlow_[next];
+          queue_.push_back(next);
+        }
+      }
+    }
+    return 0;
+  }
+
+  std::vector<Cap> pathFlow_;
+  std::vector<u32> parentEdge_;
+  std::vector<u32> queue_;
+};
+
+// Capacity scaling (Ahuja and Orlin): augmenting paths only through edges with at least delta
+// left, delta halving from the largest finite capacity. A phase ends after O(E) augmentations,
+// so there are O(E log U) in all instead of a count that depends on the capacities. Floating
+// point capacities stop halving at the type's precision; the last phase takes any path.
+template <typename Cap> class capacityScaling {
+public:
+  using net = basicFlownet<Cap>;
+  using flowType = typename net::flowType;
+
+  flowType run(net &g, u32 s, u32 t) {
+    Cap largest = 0;
+    for (Cap c : g.capacity_) {
+      if (c < net::infiniteCapacity) {
+        largest = std::max(largest, c);
+      }
+    }
+    flowType flow = 0;
+    for (Cap delta = floorPow2(largest); delta > 0; delta = nextDelta(delta, largest)) {
+      BROC_ZONE("scaling phase");
+      flow += paths_.run(g, s, t, delta);
+    }
+    return flow + paths_.run(g, s, t, 0);
+  }
+
+private:
+  static Cap floorPow2(Cap c) {
+    if (c <= 0) {
+      return 0;
+    }
+    if constexpr (std::is_integral_v<Cap>) {
+      return static_cast<Cap>(std::bit_floor(static_cast<std::make_unsigned_t<Cap>>(c)));
+    } else {
+      return std::exp2(std::floor(std::log2(c)));
+    }
+  }
+
+  static Cap nextDelta(Cap delta, Cap largest) {
+    Cap half = delta / 2;
+    if constexpr (!std::is_integral_v<Cap>) {
+      // below this, sums with the largest capacity no longer change
+      if (half < largest * std::numeric_limits<Cap>::epsilon()) {
+        return 0;
+      }
+    }
+    return half;
+  }
+
+  edmondsKarp<Cap> paths_;
+};
+
+// Highest-label push-relabel with periodic global relabeling (exact distances by a reverse BFS
+// from the sink, then from the source for vertices that can only return their excess).
+// Runs both phases, so the result is a real flow and the residual cut matches the other solvers.
+template <typename Cap> class pushRelabel {
+public:
+  using net = basicFlownet<Cap>;
+  using flowType = typename net::flowType;
+
+  flowType run(net &g, u32 s, u32 t) {
+    n_ = static_cast<u32>(g.nVertices());
+    excess_.assign(n_, 0);
+    height_.assign(n_, 0);
+    current_.assign(g.rowBeg_.begin(), g.rowBeg_.end() - 1);
+    bucket_.assign(2 * n_ + 1, noVertex);
+    next_.assign(n_, noVertex);
+    queue_.reserve(n_);
+
+    // no finite cut takes more than all finite capacities together; sending more out of the
+    // source would leave excess so large that floating point pushes off it round to nothing
+    flowType finiteTotal = 0;
+    for (Cap c : g.capacity_) {
+      finiteTotal += (c < net::infiniteCapacity) ? c : 0;
+    }
+    const Cap sourcePush =
+        static_cast<Cap>(std::min<flowType>(finiteTotal, capacityTraits<Cap>::maximum));
+    for (u32 e = g.rowBeg_[s]; e < g.rowBeg_[s + 1]; ++e) {
+      Cap d = std::min(g.residual_[e], sourcePush);
+      g.push(e, d);
+      excess_[g.head_[e]] += d;
+    }
+    globalRelabel(g, s, t);
+
+    const u64 relabelPeriod = n_ + g.nEdges() / 2;
+    u64 work = 0;
+    while (maxActive_ >= 0) {
+      u32 u = bucket_[maxActive_];
+      if (u == noVertex) {
+        --maxActive_;
+        continue;
+      }
+      bucket_[maxActive_] = next_[u];
+      work += discharge(g, u);
+      if (work > relabelPeriod) {
+        globalRelabel(g, s, t);
+        work = 0;
+      }
+    }
+    return excess_[t];
+  }
+
+private:
+  static constexpr u32 noVertex = std::numeric_limits<u32>::max();
+
+  void activate(u32 v) {
+    next_[v] = bucket_[height_[v]];
+    bucket_[height_[v]] = v;
+    maxActive_ = std::max(maxActive_, static_cast<i64>(height_[v]));
+  }
+
+  // pushes all excess out of u, returns the amount of relabel work done
+  u64 discharge(net &g, u32 u) {
+    u64 work = 0;
+    while (excess_[u] > 0) {
+      if (current_[u] == g.rowBeg_[u + 1]) {
+        u32 minHeight = 2 * n_;
+        for (u32 e = g.rowBeg_[u]; e < g.rowBeg_[u + 1]; ++e) {
+          if (g.residual_[e] > 0) {
+            minHeight = std::min(minHeight, height_[g.head_[e]] + 1);
+          }
+        }
+        height_[u] = minHeight;
+        current_[u] = g.rowBeg_[u];
+        work += 12 + g.rowBeg_[u + 1] - g.rowBeg_[u];
+        if (minHeight >= 2 * n_) {
+          break;
+        }
+        continue;
+      }
+      u32 e = current_[u];
+      u32 v = g.head_[e];
+      if (g.residual_[e] > 0 && height_[u] == height_[v] + 1) {
+        Cap d = static_cast<Cap>(std::min<flowType>(excess_[u], g.residual_[e]));
+        g.push(e, d);
+        excess_[u] -= d;
+        if (excess_[v] == 0 && v != source_ && v != sink_) {
+          activate(v);
+        }
+        excess_[v] += d;
+      } else {
+        ++current_[u];
+      }
+    }
+    return work;
+  }
+
+  // reverse BFS from root through residual edges, assigning base + distance
+  void bfsHeights(const net &g, u32 root, u32 base) {
+    queue_.clear();
+    queue_.push_back(root);
+    height_[root] = base;
+    for (size_t head = 0; head < queue_.size(); ++head) {
+      u32 y = queue_[head];
+      for (u32 e = g.rowBeg_[y]; e < g.rowBeg_[y + 1]; ++e) {
+        u32 x = g.head_[e];
+        if (height_[x] == unlabeled() && g.residual_[g.reverse_[e]] > 0) {
+          height_[x] = height_[y] + 1;
+          queue_.push_back(x);
+        }
+      }
+    }
+  }
+
+  u32 unlabeled() const { return 2 * n_; }
+
+  void globalRelabel(const net &g, u32 s, u32 t) {
+    source_ = s;
+    sink_ = t;
+    std::fill(height_.begin(), height_.end(), unlabeled());
+    height_[s] = n_;
+    bfsHeights(g, t, 0);
+    height_[s] = unlabeled();
+    bfsHeights(g, s, n_);
+
+    std::fill(bucket_.begin(), bucket_.end(), noVertex);
+    maxActive_ = -1;
+    for (u32 v = 0; v < n_; ++v) {
+      current_[v] = g.rowBeg_[v];
+      if (excess_[v] > 0 && v != s && v != t && height_[v] < unlabeled()) {
+        activate(v);
+      }
+    }
+  }
+
+  u32 n_ = 0;
+  u32 source_ = 0;
+  u32 sink_ = 0;
+  i64 maxActive_ = -1;
+  std::vector<flowType> excess_;
+  std::vector<u32> height_;
+  std::vector<u32> current_;
+  std::vector<u32> bucket_;
+  std::vector<u32> next_;
+  std::vector<u32> queue_;
+};
+
+// Boykov-Kolmogorov: grows a search tree from each terminal and reuses both trees between
+// augmentations instead of starting every path search from scratch. Terminal links are kept
+// per vertex in terminal_ (> 0: residual capacity from the source, < 0: to the sink).
+template <typename Cap> class boykovKolmogorov {
+public:
+  using net = basicFlownet<Cap>;
+  using flowType = typename net::flowType;
+
+  static constexpr flowType infiniteCapacity = capacityTraits<Cap>::infiniteTerminal;
+
+  flowType run(net &g, u32 s, u32 t) {
+    terminal_.assign(g.nVertices(), 0);
+    terminal_[s] = infiniteCapacity;
+    terminal_[t] = -infiniteCapacity;
+    return run(g);
+  }
+
+  // max-flow with the terminal links already set in terminal_
+  flowType run(net &g) {
+    size_t n = g.nVertices();
+    parent_.assign(n, free);
+    isSink_.assign(n, 0);
+    timestamp_.assign(n, 0);
+    dist_.assign(n, 0);
+    inActive_.assign(n, 0);
+    active_.assign(n, 0);
+    activeHead_ = 0;
+    activeCount_ = 0;
+    orphans_.clear();
+    time_ = 0;
+    for (u32 v = 0; v < n; ++v) {
+      if (terminal_[v] != 0) {
+        parent_[v] = terminal;
+        isSink_[v] = terminal_[v] < 0;
+        dist_[v] = 1;
+        setActive(v);
+      }
+    }
+
+    flowType flow = 0;
+    while (activeCount_ > 0) {
+      u32 i = active_[activeHead_];
+      activeHead_ = (activeHead_ + 1 == active_.size()) ? 0 : activeHead_ + 1;
+      --activeCount_;
+      inActive_[i] = 0;
+      if (parent_[i] == free) {
+        continue;
+      }
+      u32 middle = grow(g, i);
+      ++time_;
+      if (middle != net::noEdge) {
+        // i may still have unexplored neighbours
+        activeHead_ = (activeHead_ == 0) ? static_cast<u32>(active_.size()) - 1 : activeHead_ - 1;
+        active_[activeHead_] = i;
+        ++activeCount_;
+        inActive_[i] = 1;
+        flow += augment(g, middle);
+        adoptOrphans(g);
+      }
+    }
+    return flow;
+  }
+
+  std::vector<flowType> terminal_;
+
+private:
+  static constexpr u32 terminal = std::numeric_limits<u32>::max() - 2;
+  static constexpr u32 orphan = std::numeric_limits<u32>::max() - 1;
+  static constexpr u32 free = std::numeric_limits<u32>::max();
+  static constexpr u32 infiniteDist = std::numeric_limits<u32>::max();
+
+  void setActive(u32 v) {
+    if (!inActive_[v]) {
+      inActive_[v] = 1;
+      u32 tail = activeHead_ + activeCount_;
+      active_[tail < active_.size() ? tail : tail - active_.size()] = v;
+      ++activeCount_;
+    }
+  }
+
+  void setOrphan(u32 v) {
+    parent_[v] = orphan;
+    orphans_.push_back(v);
+  }
+
+  // parent_[v] is the edge v -> parent; in the source tree flow goes parent -> v, so the
+  // residual that matters is the reverse edge, in the sink tree it is the edge itself
+  bool treeEdgeOpen(const net &g, u32 e, bool sinkTree) const {
+    return sinkTree ? g.residual_[e] > 0 : g.residual_[g.reverse_[e]] > 0;
+  }
+
+  // returns the edge S -> T that connects the trees, or noEdge
+  u32 grow(const net &g, u32 i) {
+    bool sinkTree = isSink_[i];
+    for (u32 e = g.rowBeg_[i]; e < g.rowBeg_[i + 1]; ++e) {
+      // the edge towards j has to carry flow away from the source (or towards the sink)
+      Cap r = sinkTree ? g.residual_[g.reverse_[e]] : g.residual_[e];
+      if (r <= 0) {
+        continue;
+      }
+      u32 j = g.head_[e];
+      if (parent_[j] == free) {
+        isSink_[j] = sinkTree;
+        parent_[j] = g.reverse_[e];
+        timestamp_[j] = timestamp_[i];
+        dist_[j] = dist_[i] + 1;
+        setActive(j);
+      } else if (isSink_[j] != sinkTree) {
+        return sinkTree ? g.reverse_[e] : e;
+      } else if (timestamp_[j] <= timestamp_[i] && dist_[j] > dist_[i]) {
+        // shorter path to the root through i
+        parent_[j] = g.reverse_[e];
+        timestamp_[j] = timestamp_[i];
+        dist_[j] = dist_[i] + 1;
+      }
+    }
+    return net::noEdge;
+  }
+
+  flowType augment(net &g, u32 middle) {
+    flowType bottleneck = g.residual_[middle];
+    u32 i = g.tail(middle);
+    for (u32 a; (a = parent_[i]) != terminal; i = g.head_[a]) {
+      bottleneck = std::min<flowType>(bottleneck, g.residual_[g.reverse_[a]]);
+    }
+    bottleneck = std::min(bottleneck, terminal_[i]);
+    i = g.head_[middle];
+    for (u32 a; (a = parent_[i]) != terminal; i = g.head_[a]) {
+      bottleneck = std::min<flowType>(bottleneck, g.residual_[a]);
+    }
+    bottleneck = std::min(bottleneck, -terminal_[i]);
+
+    Cap d = static_cast<Cap>(bottleneck);
+    g.push(middle, d);
+    for (i = g.tail(middle);;) {
+      u32 a = parent_[i];
+      if (a == terminal) {
+        terminal_[i] -= d;
+        if (terminal_[i] == 0) {
+          setOrphan(i);
+        }
+        break;
+      }
+      g.push(g.reverse_[a], d);
+      if (g.residual_[g.reverse_[a]] == 0) {
+        setOrphan(i);
+      }
+      i = g.head_[a];
+    }
+    for (i = g.head_[middle];;) {
+      u32 a = parent_[i];
+      if (a == terminal) {
+        terminal_[i] += d;
+        if (terminal_[i] == 0) {
+          setOrphan(i);
+        }
+        break;
+      }
+      g.push(a, d);
+      if (g.residual_[a] == 0) {
+        setOrphan(i);
+      }
+      i = g.head_[a];
+    }
+    return d;
+  }
+
+  // distance from v to its terminal, infiniteDist when the path runs into an orphan
+  u32 originDistance(const net &g, u32 v) {
+    u32 d = 0;
+    for (u32 j = v;;) {
+      if (timestamp_[j] == time_) {
+        return d + dist_[j];
+      }
+      u32 a = parent_[j];
+      ++d;
+      if (a == terminal) {
+        timestamp_[j] = time_;
+        dist_[j] = 1;
+        return d;
+      }
+      if (a == orphan) {
+        return infiniteDist;
+      }
+      j = g.head_[a];
+    }
+  }
+
+  void adoptOrphans(const net &g) {
+    for (size_t k = 0; k < orphans_.size(); ++k) {
+      u32 i = orphans_[k];
+      bool sinkTree = isSink_[i];
+      u32 bestEdge = net::noEdge;
+      u32 bestDist = infiniteDist;
+      for (u32 e = g.rowBeg_[i]; e < g.rowBeg_[i + 1]; ++e) {
+        u32 j = g.head_[e];
+        if (!treeEdgeOpen(g, e, sinkTree) || isSink_[j] != sinkTree || parent_[j] == free) {
+          continue;
+        }
+        u32 d = originDistance(g, j);
+        if (d == infiniteDist) {
+          continue;
+        }
+        if (d < bestDist) {
+          bestEdge = e;
+          bestDist = d;
+        }
+        for (u32 m = j; timestamp_[m] != time_; m = g.head_[parent_[m]]) {
+          timestamp_[m] = time_;
+          dist_[m] = d--;
+        }
+      }
+
+      if (bestEdge != net::noEdge) {
+        parent_[i] = bestEdge;
+        timestamp_[i] = time_;
+        dist_[i] = bestDist + 1;
+        continue;
+      }
+      // no valid parent: i leaves the tree, its children become orphans
+      parent_[i] = free;
+      for (u32 e = g.rowBeg_[i]; e < g.rowBeg_[i + 1]; ++e) {
+        u32 j = g.head_[e];
+        u32 a = parent_[j];
+        if (isSink_[j] != sinkTree || a == free) {
+          continue;
+        }
+        if (treeEdgeOpen(g, e, sinkTree)) {
+          setActive(j);
+        }
+        if (a != terminal && a != orphan && g.head_[a] == i) {
+          setOrphan(j);
+        }
+      }
+    }
+    orphans_.clear();
+  }
+
+  std::vector<u32> parent_;
+  std::vector<u8> isSink_;
+  std::vector<u32> timestamp_;
+  std::vector<u32> dist_;
+  std::vector<u8> inActive_;
+  // FIFO of active vertices as a ring, each vertex is in it at most once
+  std::vector<u32> active_;
+  u32 activeHead_ = 0;
+  u32 activeCount_ = 0;
+  std::vector<u32> orphans_;
+  u32 time_ = 0;
+};
+
+template <typename Cap>
+std::vector<size_t> basicFlownet<Cap>::mincut(size_t s, size_t t, maxflow algorithm) {
+  BROC_ZONE("mincut");
+  residual_ = capacity_;
+  switch (algorithm) {
+  case maxflow::edmondsKarp:
+    flow_ = edmondsKarp<Cap>{}.run(*this, static_cast<u32>(s), static_cast<u32>(t));
+    break;
+  case maxflow::pushRelabel:
+    flow_ = pushRelabel<Cap>{}.run(*this, static_cast<u32>(s), static_cast<u32>(t));
+    break;
+  case maxflow::boykovKolmogorov:
+    flow_ = boykovKolmogorov<Cap>{}.run(*this, static_cast<u32>(s), static_cast<u32>(t));
+    break;
+  case maxflow::capacityScaling:
+    flow_ = capacityScaling<Cap>{}.run(*this, static_cast<u32>(s), static_cast<u32>(t));
+    break;
+  }
+  BROC_COUNTER("flow", flow_);
+  return reachable({static_cast<u32>(s)});
+}
+
+// Max-flow state kept alive between cuts. Seeds are infinite terminal links, so adding, removing
+// or moving a seed and changing edge capacities only reparametrize the residual graph (Kohli and
+// Torr, dynamic graph cuts) and the next cut continues from the previous flow instead of zero.
+// Per-cut scratch comes from scratch(), reset by the caller before each cut; once the solver
+// arrays and the arena have grown to the mesh, a repeated cut does not touch the heap.
+// With floating point capacities a seed change restarts the flow: an infinite link minus
+// itself is NaN, not zero.
+template <typename Cap> class basicCutSession {
+public:
+  using net = basicFlownet<Cap>;
+  using flowType = typename net::flowType;
+
+  basicCutSession() = default;
+  explicit basicCutSession(net g) : g_(std::move(g)), seedCapacity_(g_.nVertices(), 0) {}
+
+  net &graph() { return g_; }
+  mem::arena &scratch() { return arena_; }
+  const std::vector<u32> &sources() const { return sources_; }
+  const std::vector<u32> &sinks() const { return sinks_; }
+  // total flow since the session went warm, up to the constants dropped by reparametrization
+  flowType flow() const { return flow_; }
+
+  // drops the stored flow, needed after anything else wrote g.residual_ (e.g. g.mincut())
+  void invalidate() { warm_ = false; }
+
+  void setCapacities(std::span<const Cap> capacity) {
+    if (!warm_) {
+      g_.capacity_.assign(capacity.begin(), capacity.end());
+      return;
+    }
+    for (u32 e = 0; e < g_.nEdges(); ++e) {
+      if (capacity[e] != g_.capacity_[e]) {
+        changeCapacity(e, static_cast<flowType>(capacity[e]) - g_.capacity_[e]);
+        g_.capacity_[e] = capacity[e];
+      }
+    }
+  }
+
+  void setSeeds(std::span<const u32> sources, std::span<const u32> sinks) {
+    if constexpr (!std::is_integral_v<Cap>) {
+      warm_ = false;
+    }
+    for (u32 v : sources_) {
+      addTerminal(v, -seedCapacity_[v]);
+    }
+    for (u32 v : sinks_) {
+      addTerminal(v, -seedCapacity_[v]);
+    }
+    // each vertex once, a repeated seed would add its infinite link again and overflow
+    sources_.assign(sources.begin(), sources.end());
+    sinks_.assign(sinks.begin(), sinks.end());
+    for (std::vector<u32> *seeds : {&sources_, &sinks_}) {
+      std::sort(seeds->begin(), seeds->end());
+      seeds->erase(std::unique(seeds->begin(), seeds->end()), seeds->end());
+    }
+    for (u32 v : sources_) {
+      addTerminal(v, boykovKolmogorov<Cap>::infiniteCapacity);
+    }
+    for (u32 v : sinks_) {
+      addTerminal(v, -boykovKolmogorov<Cap>::infiniteCapacity);
+    }
+  }
+
+  // sorted indices of vertices in S-part of the flow network, in scratch()
+  std::span<u32> cut() {
+    BROC_ZONE("session cut");
+    if (!warm_) {
+      g_.residual_ = g_.capacity_;
+      solver_.terminal_ = seedCapacity_;
+      flow_ = 0;
+      warm_ = true;
+    }
+    flow_ += solver_.run(g_);
+    std::span<u32> roots = arena_.alloc<u32>(g_.nVertices());
+    size_t nRoots = 0;
+    for (u32 v = 0; v < g_.nVertices(); ++v) {
+      if (solver_.terminal_[v] > 0) {
+        roots[nRoots++] = v;
+      }
+    }
+    return g_.reachable(roots.first(nRoots), arena_);
+  }
+
+private:
+  void addTerminal(u32 v, flowType delta) {
+    // a vertex that is both a source and a sink ends up with no link, infinite or not
+    seedCapacity_[v] = (seedCapacity_[v] == -delta) ? 0 : seedCapacity_[v] + delta;
+    if (warm_) {
+      solver_.terminal_[v] += delta;
+    }
+  }
+
+  // r(u -> v) += delta; a negative result is moved onto the twin edge and the terminal links:
+  // r [u in S][v in T] = r - r [u in T] - r [v in S] + r [u in T][v in S]
+  void changeCapacity(u32 e, flowType delta) {
+    const flowType maxCapacity = capacityTraits<Cap>::maximum;
+    flowType r = g_.residual_[e] + delta;
+    if (r >= 0) {
+      g_.residual_[e] = static_cast<Cap>(std::min(r, maxCapacity));
+      return;
+    }
+    u32 u = g_.tail(e);
+    u32 v = g_.head_[e];
+    g_.residual_[e] = 0;
+    Cap &back = g_.residual_[g_.reverse_[e]];
+    back = static_cast<Cap>(std::clamp(back + r, flowType{0}, maxCapacity));
+    solver_.terminal_[u] -= r;
+    solver_.terminal_[v] += r;
+    flow_ += r;
+  }
+
+  net g_;
+  boykovKolmogorov<Cap> solver_;
+  // terminal capacity of every vertex as set by the seeds, +inf for sources and -inf for sinks
+  std::vector<flowType> seedCapacity_;
+  std::vector<u32> sources_;
+  std::vector<u32> sinks_;
+  mem::arena arena_;
+  bool warm_ = false;
+  flowType flow_ = 0;
+};
+
+using cutSession = basicCutSession<i32>;
+
+// Multi-label cut with a Potts pairwise term: the labels of seeds[k] are pinned to k and every
+// other vertex gets the label minimising sum w(u, v) [l(u) != l(v)]. Solved by alpha-expansion
+// (Boykov, Veksler, Zabih): each move is a binary cut "keep the label" (S) / "switch to alpha"
+// (T) on the same network. weight[e] must be symmetric and at most g.infiniteCapacity.
+// stop is asked before every move, the labels so far are returned once it says yes.
+template <typename Cap>
+std::vector<u32> alphaExpansion(basicFlownet<Cap> &g, const std::vector<Cap> &weight,
+                                       const std::vector<std::vector<u32>> &seeds,
+                                       size_t maxSweeps = 4,
+                                       const std::function<bool()> &stop = {}) {
+  BROC_ZONE("alphaExpansion");
+  const u32 nLabels = static_cast<u32>(seeds.size());
+  const u32 unlabeled = std::numeric_limits<u32>::max();
+  using flowType = typename basicFlownet<Cap>::flowType;
+  const flowType inf = boykovKolmogorov<Cap>::infiniteCapacity;
+  size_t n = g.nVertices();
+
+  // pinned labels, then the rest starts from the nearest seed (multi-source BFS)
+  std::vector<u32> pinned(n, unlabeled);
+  std::vector<u32> label(n, unlabeled);
+  std::vector<u32> queue;
+  for (u32 k = 0; k < nLabels; ++k) {
+    for (u32 v : seeds[k]) {
+      if (label[v] == unlabeled) {
+        pinned[v] = label[v] = k;
+        queue.push_back(v);
+      }
+    }
+  }
+  for (size_t head = 0; head < queue.size(); ++head) {
+    u32 curr = queue[head];
+    for (u32 e = g.rowBeg_[curr]; e < g.rowBeg_[curr + 1]; ++e) {
+      u32 next = g.head_[e];
+      if (label[next] == unlabeled) {
+        label[next] = label[curr];
+        queue.push_back(next);
+      }
+    }
+  }
+  for (u32 &l : label) {
+    l = (l == unlabeled) ? 0 : l;
+  }
+
+  boykovKolmogorov<Cap> solver;
+  std::vector<u8> keeps(n);
+  for (size_t sweep = 0; sweep < maxSweeps; ++sweep) {
+    bool changed = false;
+    for (u32 alpha = 0; alpha < nLabels; ++alpha) {
+      if (stop && stop()) {
+        return label;
+      }
+      // E(x_u, x_v) = A + (C - A) x_u + (D - C) x_v + (B + C - A - D) [x_u = 0][x_v = 1]
+      // with A = w [l_u != l_v], B = w [l_u != alpha], C = w [alpha != l_v], D = 0
+      std::vector<flowType> &terminal = solver.terminal_;
+      terminal.assign(n, 0);
+      for (u32 u = 0; u < n; ++u) {
+        if (pinned[u] != unlabeled) {
+          terminal[u] = (pinned[u] == alpha) ? -inf : inf;
+        }
+        for (u32 e = g.rowBeg_[u]; e < g.rowBeg_[u + 1]; ++e) {
+          u32 v = g.head_[e];
+          if (v < u) {
+            continue;
+          }
+          flowType w = weight[e];
+          flowType A = (label[u] != label[v]) ? w : 0;
+          flowType B = (label[u] != alpha) ? w : 0;
+          flowType C = (alpha != label[v]) ? w : 0;
+          terminal[u] += C - A;
+          terminal[v] -= C;
+          g.capacity_[e] = static_cast<Cap>(B + C - A);
+          g.capacity_[g.reverse_[e]] = 0;
+        }
+      }
+      g.residual_ = g.capacity_;
+      {
+        BROC_ZONE("expansion move");
+        solver.run(g);
+      }
+
+      std::vector<u32> roots;
+      for (u32 v = 0; v < n; ++v) {
+        if (terminal[v] > 0) {
+          roots.push_back(v);
+        }
+      }
+      std::fill(keeps.begin(), keeps.end(), 0);
+      for (size_t v : g.reachable(roots)) {
+        keeps[v] = 1;
+      }
+      for (u32 v = 0; v < n; ++v) {
+        if (!keeps[v] && label[v] != alpha) {
+          label[v] = alpha;
+          changed = true;
+        }
+      }
+    }
+    if (!changed) {
+      break;
+    }
+  }
+  return label;
+}
+
+/*!todo test
+    math::flownet g{{0, 2, 6, 9, 13, 16, 18},
+                    {1, 4, 0, 2, 3, 4, 1, 3, 5, 1, 2, 4, 5, 0, 1, 3, 2, 3}};
+    g.capacity_ = {7, 4, 0, 5, 3, 0, 0, 0, 8, 0, 3, 0, 5, 0, 3, 2, 0, 0};
+
+    std::vector<size_t> borderVertexIndices = g.mincut(0, 5);
+    for (auto v : borderVertexIndices) {
+      std::cout << v << ", ";
+    }
+ * */
+
+} // namespace math
+} // namespace brocseg
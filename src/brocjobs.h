@@ -0,0 +1,173 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "broccommon.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace jobs {
+
+// Shared by a job and whoever submitted it: a cancel flag the job polls between stages, and
+// progress the frame loop polls to draw. Stage names must outlive the job, literals in practice.
+class token : public std::enable_shared_from_this<token> {
+public:
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+  bool done() const { return done_.load(std::memory_order_acquire); }
+
+  void progress(float fraction, const char *stage) {
+    stage_.store(stage, std::memory_order_relaxed);
+    progress_.store(fraction, std::memory_order_relaxed);
+  }
+  float progress() const { return progress_.load(std::memory_order_relaxed); }
+  const char *stage() const { return stage_.load(std::memory_order_relaxed); }
+
+private:
+  friend class worker;
+
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> done_{false};
+  std::atomic<float> progress_{0.0f};
+  std::atomic<const char *> stage_{"queued"};
+};
+
+// Multi-producer single-consumer queue: producers push onto a lock-free stack, the consumer
+// takes the whole stack at once and reverses it into submission order.
+template <typename T> class mpscQueue {
+public:
+  struct node {
+    T value;
+    node *next = nullptr;
+  };
+
+  mpscQueue() = default;
+  mpscQueue(const mpscQueue &) = delete;
+  mpscQueue &operator=(const mpscQueue &) = delete;
+  ~mpscQueue() {
+    for (node *n = takeAll(); n != nullptr;) {
+      delete std::exchange(n, n->next);
+    }
+  }
+
+  void push(T value) {
+    node *n = new node{std::move(value)};
+    n->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+  }
+
+  // oldest first, the caller owns and deletes the nodes
+  node *takeAll() {
+    node *n = head_.exchange(nullptr, std::memory_order_acquire);
+    node *ordered = nullptr;
+    while (n != nullptr) {
+      node *next = n->next;
+      n->next = ordered;
+      ordered = n;
+      n = next;
+    }
+    return ordered;
+  }
+
+private:
+  std::atomic<node *> head_{nullptr};
+};
+
+// One background thread for the work that must not block the frame loop. Jobs run in
+// submission order. A job hands results back with post(); the frame loop runs them in
+// runPosted(), where they may touch GL and the scene. Results of a job cancelled before
+// runPosted() gets to them are dropped, so cancelling from the frame loop is final.
+class worker {
+public:
+  using job = std::function<void(token &)>;
+
+  worker() : thread_([this] { loop(); }) {}
+  worker(const worker &) = delete;
+  worker &operator=(const worker &) = delete;
+  // pending jobs are cancelled, a running one is waited for
+  ~worker() {
+    stop_.store(true, std::memory_order_relaxed);
+    wake();
+    thread_.join();
+    for (auto *n = posted_.takeAll(); n != nullptr;) {
+      delete std::exchange(n, n->next);
+    }
+  }
+
+  std::shared_ptr<token> submit(job f) {
+    std::shared_ptr<token> tok = std::make_shared<token>();
+    jobs_.push({std::move(f), tok});
+    wake();
+    return tok;
+  }
+
+  // from inside a job: f runs on the frame loop unless tok is cancelled first
+  void post(token &tok, std::function<void()> f) {
+    posted_.push({std::move(f), tok.shared_from_this()});
+  }
+
+  // from the frame loop
+  void runPosted() {
+    for (auto *n = posted_.takeAll(); n != nullptr;) {
+      if (!n->value.tok->cancelled()) {
+        n->value.f();
+      }
+      delete std::exchange(n, n->next);
+    }
+  }
+
+private:
+  struct pendingJob {
+    job f;
+    std::shared_ptr<token> tok;
+  };
+  struct postedResult {
+    std::function<void()> f;
+    std::shared_ptr<token> tok;
+  };
+
+  void wake() {
+    signal_.fetch_add(1, std::memory_order_release);
+    signal_.notify_one();
+  }
+
+  void loop() {
+    while (true) {
+      u32 seen = signal_.load(std::memory_order_acquire);
+      auto *n = jobs_.takeAll();
+      if (n == nullptr) {
+        if (stop_.load(std::memory_order_relaxed)) {
+          return;
+        }
+        signal_.wait(seen, std::memory_order_acquire);
+        continue;
+      }
+      while (n != nullptr) {
+        token &tok = *n->value.tok;
+        if (stop_.load(std::memory_order_relaxed)) {
+          tok.cancel();
+        }
+        if (!tok.cancelled()) {
+          BROC_ZONE("job");
+          n->value.f(tok);
+        }
+        tok.done_.store(true, std::memory_order_release);
+        delete std::exchange(n, n->next);
+      }
+    }
+  }
+
+  mpscQueue<pendingJob> jobs_;
+  mpscQueue<postedResult> posted_;
+  std::atomic<u32> signal_{0};
+  std::atomic<bool> stop_{false};
+  std::thread thread_; // last, starts once everything above is ready
+};
+
+} // namespace jobs
+} // namespace brocseg
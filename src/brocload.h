@@ -0,0 +1,557 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "broccache.h"
+#include "broccommon.h"
+#include "broccurv.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace load {
+
+// Flat triangle mesh straight from a file, what loadMesh produced through OpenMesh.
+struct triangleMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<u32> indices;
+};
+
+// [bounds[c], bounds[c + 1]) splits text into nChunks ranges that each end after a newline
+inline std::vector<size_t> lineChunks(const char *text, size_t size, size_t nChunks) {
+  std::vector<size_t> bounds(nChunks + 1, size);
+  bounds[0] = 0;
+  for (size_t c = 1; c < nChunks; ++c) {
+    size_t at = std::max(bounds[c - 1], size * c / nChunks);
+    const void *newline = std::memchr(text + at, '\n', size - at);
+    bounds[c] = newline ? static_cast<const char *>(newline) - text + 1 : size;
+  }
+  return bounds;
+}
+
+// exclusive prefix sum in place, returns the total
+inline size_t exclusiveScan(std::vector<size_t> &counts) {
+  size_t total = 0;
+  for (size_t &c : counts) {
+    size_t n = c;
+    c = total;
+    total += n;
+  }
+  return total;
+}
+
+inline u32 positionHash(const glm::vec3 &p) {
+  u32 bits[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    // -0 and +0 are the same point
+    float x = (p[axis] == 0.0f) ? 0.0f : p[axis];
+    std::memcpy(&bits[axis], &x, sizeof(x));
+  }
+  u64 h = (u64(bits[0]) << 32 | bits[1]) * 0x9e3779b97f4a7c15ull;
+  h ^= (h >> 29) ^ (u64(bits[2]) * 0xbf58476d1ce4e5b9ull);
+  h ^= h >> 32;
+  return static_cast<u32>(h);
+}
+
+// removes triangles with a repeated vertex, OpenMesh refuses to add those
+inline void dropDegenerate(std::vector<u32> &indices) {
+  size_t kept = 0;
+  for (size_t t = 0; t < indices.size() / 3; ++t) {
+    u32 a = indices[3 * t], b = indices[3 * t + 1], c = indices[3 * t + 2];
+    if (a != b && b != c && a != c) {
+      indices[3 * kept] = a;
+      indices[3 * kept + 1] = b;
+      indices[3 * kept + 2] = c;
+      ++kept;
+    }
+  }
+  indices.resize(3 * kept);
+}
+
+// Welds the corners of a triangle soup that sit on the same position, as the OpenMesh STL
+// reader does, but in parallel: corners are bucketed by hash, every bucket is welded by one
+// thread, and vertices are numbered in order of first use. corner(i) is the position of
+// corner i. Triangles that collapse to an edge or a point are dropped.
+template <typename Corner> void weldCorners(size_t nCorners, Corner &&corner, triangleMesh &out) {
+  BROC_ZONE("weld");
+  const u32 noCorner = 0xffffffffu;
+  const size_t nChunks = par::nThreads();
+  const int bucketBits = std::max(6, static_cast<int>(std::bit_width(4 * nChunks)));
+  const size_t nBuckets = size_t{1} << bucketBits;
+  auto bucketOf = [&](u32 hash) { return hash >> (32 - bucketBits); };
+
+  // corners sorted by bucket, in corner order within a bucket
+  std::vector<size_t> counts(nChunks * nBuckets, 0);
+  std::vector<u32> order(nCorners);
+  auto chunkRange = [&](size_t c) {
+    return std::pair<size_t, size_t>{nCorners * c / nChunks, nCorners * (c + 1) / nChunks};
+  };
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      auto [first, last] = chunkRange(c);
+      for (size_t i = first; i < last; ++i) {
+        ++counts[bucketOf(positionHash(corner(i))) * nChunks + c];
+      }
+    }
+  }, 1);
+  exclusiveScan(counts);
+  std::vector<size_t> bucketBeg(nBuckets + 1);
+  for (size_t b = 0; b < nBuckets; ++b) {
+    bucketBeg[b] = counts[b * nChunks];
+  }
+  bucketBeg[nBuckets] = nCorners;
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      auto [first, last] = chunkRange(c);
+      for (size_t i = first; i < last; ++i) {
+        order[counts[bucketOf(positionHash(corner(i))) * nChunks + c]++] = static_cast<u32>(i);
+      }
+    }
+  }, 1);
+
+  // first corner at the same position, per bucket with an open addressing table
+  out.indices.resize(nCorners);
+  par::forChunks(nBuckets, [&](size_t beg, size_t end) {
+    std::vector<u32> table;
+    for (size_t b = beg; b < end; ++b) {
+      size_t n = bucketBeg[b + 1] - bucketBeg[b];
+      size_t mask = std::bit_ceil(2 * n + 1) - 1;
+      table.assign(mask + 1, noCorner);
+      for (size_t k = bucketBeg[b]; k < bucketBeg[b + 1]; ++k) {
+        u32 i = order[k];
+        glm::vec3 p = corner(i);
+        size_t slot = positionHash(p) & mask;
+        while (table[slot] != noCorner && corner(table[slot]) != p) {
+          slot = (slot + 1) & mask;
+        }
+        if (table[slot] == noCorner) {
+          table[slot] = i;
+        }
+        out.indices[i] = table[slot];
+      }
+    }
+  }, 1);
+
+  // vertex ids in order of first use, order is reused for the id of every first corner
+  std::vector<size_t> firstCounts(nChunks, 0);
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      auto [first, last] = chunkRange(c);
+      for (size_t i = first; i < last; ++i) {
+        firstCounts[c] += out.indices[i] == i;
+      }
+    }
+  }, 1);
+  size_t nVertices = exclusiveScan(firstCounts);
+  out.positions.resize(nVertices);
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      auto [first, last] = chunkRange(c);
+      u32 next = static_cast<u32>(firstCounts[c]);
+      for (size_t i = first; i < last; ++i) {
+        if (out.indices[i] == i) {
+          order[i] = next;
+          out.positions[next++] = corner(i);
+        }
+      }
+    }
+  }, 1);
+  par::forChunks(nCorners, [&](size_t beg, size_t end) {
+    for (size_t i = beg; i < end; ++i) {
+      out.indices[i] = order[out.indices[i]];
+    }
+  });
+  dropDegenerate(out.indices);
+}
+
+// binary STL: 80 byte header, triangle count, 50 bytes per triangle
+inline std::optional<triangleMesh> parseStl(const u8 *data, size_t size) {
+  BROC_ZONE("parseStl");
+  if (size < 84) {
+    return std::nullopt;
+  }
+  u32 nTriangles;
+  std::memcpy(&nTriangles, data + 80, sizeof(nTriangles));
+  // ascii files start with "solid" too, the size tells them apart
+  if (size != 84 + 50 * u64(nTriangles)) {
+    return std::nullopt;
+  }
+  const u8 *first = data + 84 + 12;
+  auto corner = [first](size_t i) {
+    glm::vec3 p;
+    std::memcpy(&p[0], first + 50 * (i / 3) + 12 * (i % 3), 3 * sizeof(float));
+    return p;
+  };
+  triangleMesh mesh;
+  weldCorners(3 * size_t{nTriangles}, corner, mesh);
+  return mesh;
+}
+
+inline const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    ++p;
+  }
+  return p;
+}
+
+inline const char *parseFloat(const char *p, const char *end, float &value) {
+  p = skipSpaces(p, end);
+  if (p < end && *p == '+') {
+    ++p;
+  }
+  std::from_chars_result r = std::from_chars(p, end, value);
+  return r.ec == std::errc() ? r.ptr : nullptr;
+}
+
+// ascii OBJ, "v x y z" and "f a b c ..." lines, polygons are fanned into triangles
+inline std::optional<triangleMesh> parseObj(const u8 *data, size_t size) {
+  BROC_ZONE("parseObj");
+  const char *text = reinterpret_cast<const char *>(data);
+  const size_t nChunks = par::nThreads();
+  std::vector<size_t> bounds = lineChunks(text, size, nChunks);
+  auto forLines = [&](size_t c, auto &&f) {
+    const char *p = text + bounds[c];
+    const char *end = text + bounds[c + 1];
+    while (p < end) {
+      const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+      eol = eol ? eol : end;
+      const char *q = skipSpaces(p, eol);
+      if (eol - q > 1 && (q[1] == ' ' || q[1] == '\t')) {
+        f(q[0], q + 2, eol);
+      }
+      p = eol + 1;
+    }
+  };
+  // a face line with k vertex references makes k - 2 triangles
+  auto countRefs = [](const char *p, const char *end) {
+    size_t refs = 0;
+    while ((p = skipSpaces(p, end)) < end) {
+      ++refs;
+      while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+        ++p;
+      }
+    }
+    return refs;
+  };
+
+  std::vector<size_t> vertexBase(nChunks, 0);
+  std::vector<size_t> triangleBase(nChunks, 0);
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    for (size_t c = beg; c < end; ++c) {
+      forLines(c, [&](char kind, const char *p, const char *eol) {
+        if (kind == 'v') {
+          ++vertexBase[c];
+        } else if (kind == 'f') {
+          triangleBase[c] += std::max<size_t>(countRefs(p, eol), 2) - 2;
+        }
+      });
+    }
+  }, 1);
+  const size_t nVertices = exclusiveScan(vertexBase);
+  const size_t nTriangles = exclusiveScan(triangleBase);
+  if (nVertices >= 0xffffffffu || 3 * nTriangles > 0xffffffffu) {
+    return std::nullopt;
+  }
+
+  triangleMesh mesh;
+  mesh.positions.resize(nVertices);
+  mesh.indices.resize(3 * nTriangles);
+  std::vector<u8> ok(nChunks, 1);
+  par::forChunks(nChunks, [&](size_t beg, size_t end) {
+    std::vector<u32> refs;
+    for (size_t c = beg; c < end; ++c) {
+      size_t v = vertexBase[c];
+      size_t t = triangleBase[c];
+      forLines(c, [&](char kind, const char *p, const char *eol) {
+        if (kind == 'v') {
+          glm::vec3 &pos = mesh.positions[v++];
+          for (int axis = 0; axis < 3 && p; ++axis) {
+            p = parseFloat(p, eol, pos[axis]);
+          }
+          ok[c] &= p != nullptr;
+        } else if (kind == 'f') {
+          refs.clear();
+          while ((p = skipSpaces(p, eol)) < eol) {
+            i64 ref = 0;
+            std::from_chars_result r = std::from_chars(p, eol, ref);
+            // 1-based, negative counts back from the last vertex so far
+            i64 idx = (ref > 0) ? ref - 1 : static_cast<i64>(v) + ref;
+            if (r.ec != std::errc() || ref == 0 || idx < 0 || idx >= i64(nVertices)) {
+              ok[c] = 0;
+              return;
+            }
+            refs.push_back(static_cast<u32>(idx));
+            p = r.ptr;
+            while (p < eol && *p != ' ' && *p != '\t' && *p != '\r') {
+              ++p;
+            }
+          }
+          for (size_t k = 2; k < refs.size(); ++k, ++t) {
+            mesh.indices[3 * t] = refs[0];
+            mesh.indices[3 * t + 1] = refs[k - 1];
+            mesh.indices[3 * t + 2] = refs[k];
+          }
+        }
+      });
+    }
+  }, 1);
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end()) {
+    return std::nullopt;
+  }
+  dropDegenerate(mesh.indices);
+  return mesh;
+}
+
+// binary PLY with float or double x, y, z and a vertex_indices list per face
+inline std::optional<triangleMesh> parsePly(const u8 *data, size_t size) {
+  BROC_ZONE("parsePly");
+  struct property {
+    std::string name;
+    int size = 0;      // scalar size, or list item size
+    int countSize = 0; // 0 for scalars
+    bool isFloat = false;
+  };
+  struct element {
+    std::string name;
+    size_t count = 0;
+    std::vector<property> properties;
+  };
+  auto typeSize = [](std::string_view type, bool &isFloat) {
+    isFloat = type == "float" || type == "float32" || type == "double" || type == "float64";
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") {
+      return 1;
+    }
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") {
+      return 2;
+    }
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" ||
+        type == "float" || type == "float32") {
+      return 4;
+    }
+    if (type == "double" || type == "float64") {
+      return 8;
+    }
+    return 0;
+  };
+
+  const char *text = reinterpret_cast<const char *>(data);
+  std::string_view header(text, std::min<size_t>(size, 1 << 16));
+  size_t headerEnd = header.find("end_header\n");
+  if (header.substr(0, 4) != "ply\n" || headerEnd == std::string_view::npos) {
+    return std::nullopt;
+  }
+  bool bigEndian = false;
+  std::vector<element> elements;
+  for (size_t at = 4; at < headerEnd;) {
+    size_t eol = header.find('\n', at);
+    std::string_view line = header.substr(at, eol - at);
+    at = eol + 1;
+    std::vector<std::string_view> words;
+    for (size_t w = 0; w < line.size();) {
+      size_t next = std::min(line.find(' ', w), line.size());
+      if (next > w) {
+        words.push_back(line.substr(w, next - w));
+      }
+      w = next + 1;
+    }
+    if (words.empty()) {
+      continue;
+    }
+    if (words[0] == "format") {
+      bool binary = words.size() >= 2 &&
+                    (words[1] == "binary_little_endian" || words[1] == "binary_big_endian");
+      if (!binary) {
+        return std::nullopt;
+      }
+      bigEndian = words[1] == "binary_big_endian";
+    } else if (words[0] == "element" && words.size() == 3) {
+      element e;
+      e.name = words[1];
+      std::from_chars(words[2].data(), words[2].data() + words[2].size(), e.count);
+      elements.push_back(e);
+    } else if (words[0] == "property" && !elements.empty()) {
+      property prop;
+      bool isFloat;
+      if (words.size() == 5 && words[1] == "list") {
+        prop.countSize = typeSize(words[2], isFloat);
+        prop.size = typeSize(words[3], prop.isFloat);
+        prop.name = words[4];
+      } else if (words.size() == 3) {
+        prop.size = typeSize(words[1], prop.isFloat);
+        prop.name = words[2];
+      }
+      if (prop.size == 0 || (words[1] == "list" && prop.countSize == 0)) {
+        return std::nullopt;
+      }
+      elements.back().properties.push_back(prop);
+    }
+  }
+
+  auto readScalar = [bigEndian](const u8 *p, int bytes, bool isFloat) -> double {
+    u8 b[8];
+    std::memcpy(b, p, bytes);
+    if (bigEndian) {
+      std::reverse(b, b + bytes);
+    }
+    if (isFloat) {
+      if (bytes == 4) {
+        float f;
+        std::memcpy(&f, b, 4);
+        return f;
+      }
+      double d;
+      std::memcpy(&d, b, 8);
+      return d;
+    }
+    // list counts and vertex indices, never negative in a valid file
+    u64 v = 0;
+    std::memcpy(&v, b, bytes);
+    return static_cast<double>(v);
+  };
+
+  triangleMesh mesh;
+  const u8 *p = data + headerEnd + std::string_view("end_header\n").size();
+  const u8 *end = data + size;
+  for (const element &e : elements) {
+    bool hasList = std::any_of(e.properties.begin(), e.properties.end(),
+                               [](const property &prop) { return prop.countSize != 0; });
+    if (!hasList) {
+      size_t stride = 0;
+      int offset[3] = {-1, -1, -1};
+      const property *coord[3] = {};
+      for (const property &prop : e.properties) {
+        for (int axis = 0; axis < 3; ++axis) {
+          if (prop.name == std::string(1, char('x' + axis))) {
+            offset[axis] = static_cast<int>(stride);
+            coord[axis] = &prop;
+          }
+        }
+        stride += prop.size;
+      }
+      if (size_t(end - p) < e.count * stride) {
+        return std::nullopt;
+      }
+      if (e.name == "vertex") {
+        if (offset[0] < 0 || offset[1] < 0 || offset[2] < 0 || e.count >= 0xffffffffu) {
+          return std::nullopt;
+        }
+        mesh.positions.resize(e.count);
+        par::forChunks(e.count, [&](size_t beg, size_t last) {
+          for (size_t v = beg; v < last; ++v) {
+            for (int axis = 0; axis < 3; ++axis) {
+              mesh.positions[v][axis] = static_cast<float>(readScalar(
+                  p + v * stride + offset[axis], coord[axis]->size, coord[axis]->isFloat));
+            }
+          }
+        });
+      }
+      p += e.count * stride;
+      continue;
+    }
+    if (e.name != "face") {
+      return std::nullopt;
+    }
+    // faces are variable length, a sequential walk finds them and fans polygons
+    mesh.indices.reserve(3 * e.count);
+    for (size_t f = 0; f < e.count; ++f) {
+      for (const property &prop : e.properties) {
+        size_t n = 1;
+        if (prop.countSize != 0) {
+          if (end - p < prop.countSize) {
+            return std::nullopt;
+          }
+          n = static_cast<size_t>(readScalar(p, prop.countSize, false));
+          p += prop.countSize;
+        }
+        if (size_t(end - p) < n * prop.size) {
+          return std::nullopt;
+        }
+        if (prop.name == "vertex_indices" || prop.name == "vertex_index") {
+          auto ref = [&](size_t k) {
+            return static_cast<u32>(readScalar(p + k * prop.size, prop.size, false));
+          };
+          for (size_t k = 2; k < n; ++k) {
+            mesh.indices.push_back(ref(0));
+            mesh.indices.push_back(ref(k - 1));
+            mesh.indices.push_back(ref(k));
+          }
+        }
+        p += n * prop.size;
+      }
+    }
+  }
+  if (std::any_of(mesh.indices.begin(), mesh.indices.end(),
+                  [&](u32 v) { return v >= mesh.positions.size(); })) {
+    return std::nullopt;
+  }
+  dropDegenerate(mesh.indices);
+  return mesh;
+}
+
+// unit vertex normals, the normalised sum of the unit normals of the incident faces
+inline std::vector<glm::vec3> vertexNormals(const std::vector<glm::vec3> &positions,
+                                            const std::vector<u32> &indices) {
+  BROC_ZONE("vertexNormals");
+  const size_t nFaces = indices.size() / 3;
+  std::vector<glm::vec3> faceNormals(nFaces);
+  par::forChunks(nFaces, [&](size_t beg, size_t end) {
+    for (size_t f = beg; f < end; ++f) {
+      const glm::vec3 &a = positions[indices[3 * f]];
+      glm::vec3 n =
+          glm::cross(positions[indices[3 * f + 1]] - a, positions[indices[3 * f + 2]] - a);
+      float l = glm::length(n);
+      faceNormals[f] = (l > 0.0f) ? n / l : glm::vec3(0.0f);
+    }
+  });
+  math::VertexCorners vc = math::vertexCornersFromFaces(positions.size(), indices);
+  std::vector<glm::vec3> normals(positions.size());
+  par::forChunks(positions.size(), [&](size_t beg, size_t end) {
+    for (size_t v = beg; v < end; ++v) {
+      glm::vec3 n(0.0f);
+      for (u32 i = vc.offsets[v]; i < vc.offsets[v + 1]; ++i) {
+        n += faceNormals[vc.corners[i] / 3];
+      }
+      float l = glm::length(n);
+      normals[v] = (l > 0.0f) ? n / l : glm::vec3(0.0f);
+    }
+  });
+  return normals;
+}
+
+// Binary STL, OBJ or binary PLY by extension, nullopt for anything else (ascii STL and PLY
+// among them) so the caller can fall back to OpenMesh.
+inline std::optional<triangleMesh> loadTriangleMesh(const std::string &path) {
+  BROC_ZONE("loadTriangleMesh");
+  std::string ext = path.substr(std::min(path.size(), path.rfind('.') + 1));
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](char c) { return static_cast<char>(std::tolower(c)); });
+  cache::mappedFile file;
+  if (!file.open(path)) {
+    return std::nullopt;
+  }
+  std::optional<triangleMesh> mesh;
+  if (ext == "stl") {
+    mesh = parseStl(file.data(), file.size());
+  } else if (ext == "obj") {
+    mesh = parseObj(file.data(), file.size());
+  } else if (ext == "ply") {
+    mesh = parsePly(file.data(), file.size());
+  }
+  if (!mesh) {
+    return std::nullopt;
+  }
+  mesh->normals = vertexNormals(mesh->positions, mesh->indices);
+  return mesh;
+}
+
+} // namespace load
+} // namespace brocseg
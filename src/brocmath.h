@@ -1,7 +1,12 @@
 #pragma once
 #include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
 #include <numeric>
-#include <queue>
+#include <stdexcept>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -15,6 +20,8 @@
 #include <glm/gtx/norm.hpp>
 
 #include "broccommon.h"
+#include "brocparallel.h"
+#include "brocprof.h"
 
 namespace brocseg {
 namespace math {
@@ -132,33 +139,138 @@ inline float meanCurvature(const glm::vec3 &p, const std::vector<glm::vec3> &adj
   return meanCurvatureSign * glm::length(meanCurvatureNormal) / 2.0f;
 }
 
-inline std::pair<float, float> percentileThreshold(std::vector<float> arr, float percentile) {
-  size_t windowSize = static_cast<size_t>(percentile * arr.size());
-  if (windowSize == 0) {
-    throw std::invalid_argument("percentileThreshold: empty window");
+// Narrowest-variance window holding a given fraction of the values.
+// The values are radix-sorted once on assign, after that every query is a scan over the cached
+// prefix sums and does not allocate.
+class percentileCache {
+public:
+  percentileCache() = default;
+  explicit percentileCache(const std::vector<float> &values, size_t nBins = 1024) {
+    assign(values, nBins);
   }
-  std::sort(arr.begin(), arr.end());
-  float mean = std::reduce(arr.begin(), arr.begin() + windowSize) / windowSize;
-  size_t windowBeg = 0;
-  float variance =
-      std::reduce(arr.begin(), arr.begin() + windowSize, 0.0f,
-                  [&mean](float acc, float val) { return acc + (val - mean) * (val - mean); }) /
-      windowSize;
-  float minVariance = variance;
-
-  for (int i = 1; i + windowSize < arr.size(); ++i) {
-    float oldval = arr[i - 1];
-    float newval = arr[i + windowSize - 1];
-    float oldmean = mean;
-    float newmean = oldmean + (newval - oldval) / windowSize;
-    mean = newmean;
-    variance += (newval - oldval) * (newval - newmean + oldval - oldmean) / (windowSize);
-    if (variance < minVariance) {
-      minVariance = variance;
-      windowBeg = i;
+
+  size_t size() const { return sorted_.size(); }
+  const std::vector<float> &sorted() const { return sorted_; }
+
+  void assign(const std::vector<float> &values, size_t nBins = 1024) {
+    BROC_ZONE("percentile sort");
+    const size_t n = values.size();
+    nBins_ = std::max<size_t>(1, nBins);
+    // lsd radix sort on order-preserving integer keys, 11 bits per pass
+    std::vector<u32> keys(n);
+    std::vector<u32> scratch(n);
+    for (size_t i = 0; i < n; ++i) {
+      keys[i] = sortKey(values[i]);
+    }
+    for (int shift = 0; shift < 32; shift += radixBits) {
+      std::vector<u32> count((1u << radixBits) + 1, 0);
+      for (u32 k : keys) {
+        ++count[((k >> shift) & radixMask) + 1];
+      }
+      std::partial_sum(count.begin(), count.end(), count.begin());
+      for (u32 k : keys) {
+        scratch[count[(k >> shift) & radixMask]++] = k;
+      }
+      keys.swap(scratch);
     }
+    sorted_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      sorted_[i] = fromSortKey(keys[i]);
+    }
+    // values are centred on the median before summing so that sum of squares minus squared sum
+    // does not cancel when the spread is small next to the magnitude; Kahan compensation keeps
+    // the running sums exact to double rounding over millions of terms
+    shift_ = n ? double(sorted_[n / 2]) : 0.0;
+    sum_.assign(n + 1, 0.0);
+    sumSq_.assign(n + 1, 0.0);
+    double sumErr = 0.0;
+    double sumSqErr = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+      double d = double(sorted_[i]) - shift_;
+      sum_[i + 1] = kahanAdd(sum_[i], d, sumErr);
+      sumSq_[i + 1] = kahanAdd(sumSq_[i], d * d, sumSqErr);
+    }
+  }
+
+  // exact: every window start, O(n)
+  std::pair<float, float> threshold(float percentile) const { return search(percentile, 1); }
+
+  // for scrubbing: window starts only at the edges of nBins equal-count histogram bins,
+  // O(nBins), the start is off by at most n / nBins ranks
+  std::pair<float, float> approximateThreshold(float percentile) const {
+    return search(percentile, std::max<size_t>(1, sorted_.size() / nBins_));
   }
-  return {arr[windowBeg], arr[windowBeg + windowSize - 1]};
+
+private:
+  static constexpr int radixBits = 11;
+  static constexpr u32 radixMask = (1u << radixBits) - 1;
+
+  static u32 sortKey(float f) {
+    u32 u;
+    std::memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+  }
+
+  static float fromSortKey(u32 k) {
+    u32 u = (k & 0x80000000u) ? (k & 0x7fffffffu) : ~k;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+  }
+
+  static double kahanAdd(double sum, double value, double &err) {
+    double y = value - err;
+    double t = sum + y;
+    err = (t - sum) - y;
+    return t;
+  }
+
+  // each window is O(1) from the prefix sums, window starts are split across threads and the
+  // lowest start wins ties, so the answer does not depend on the thread count
+  std::pair<float, float> search(float percentile, size_t stride) const {
+    const size_t n = sorted_.size();
+    size_t windowSize = std::min(n, static_cast<size_t>(percentile * n));
+    if (windowSize == 0) {
+      throw std::invalid_argument("percentileThreshold: empty window");
+    }
+    const size_t last = n - windowSize;
+    const size_t nStarts = last / stride + 1 + (last % stride != 0);
+    std::mutex bestMutex;
+    size_t windowBeg = 0;
+    double minVariance = std::numeric_limits<double>::infinity();
+    par::forChunks(nStarts, [&](size_t beg, size_t end) {
+      BROC_ZONE("percentile windows");
+      size_t localBeg = 0;
+      double localMin = std::numeric_limits<double>::infinity();
+      for (size_t k = beg; k < end; ++k) {
+        size_t i = std::min(k * stride, last);
+        double s = sum_[i + windowSize] - sum_[i];
+        double variance = (sumSq_[i + windowSize] - sumSq_[i] - s * s / windowSize) / windowSize;
+        if (variance < localMin) {
+          localMin = variance;
+          localBeg = i;
+        }
+      }
+      std::lock_guard<std::mutex> lock(bestMutex);
+      if (localMin < minVariance || (localMin == minVariance && localBeg < windowBeg)) {
+        minVariance = localMin;
+        windowBeg = localBeg;
+      }
+    }, 1 << 16);
+    return {sorted_[windowBeg], sorted_[windowBeg + windowSize - 1]};
+  }
+
+  std::vector<float> sorted_;
+  std::vector<double> sum_;
+  std::vector<double> sumSq_;
+  double shift_ = 0.0;
+  size_t nBins_ = 1024;
+};
+
+// one-off query, callers that ask repeatedly should keep a percentileCache
+inline std::pair<float, float> percentileThreshold(const std::vector<float> &arr,
+                                                   float percentile) {
+  return percentileCache{arr}.threshold(percentile);
 }
 
 glm::vec3 rgbFromHsv(float H_, float S_, float V_) {
@@ -196,89 +308,28 @@ inline glm::vec3 colorFromNormalized(float val) {
   return rgbFromHsv(val * (240.0f / 360.0f), 1.0, 1.0);
 }
 
-class flownet {
-public:
-  i32 bfs(size_t s, size_t t, std::vector<size_t> &parent,
-          std::vector<std::vector<i32>> &residualCapacity) {
-    std::fill(parent.begin(), parent.end(), -1);
-    parent[s] = -2;
-    std::queue<std::pair<size_t, i32>> q;
-    q.push({s, std::numeric_limits<i32>::max()});
-    while (!q.empty()) {
-      size_t curr = q.front().first;
-      i32 flow = q.front().second;
-      q.pop();
-      for (size_t next : adj_[curr]) {
-        if (parent[next] == -1 && residualCapacity[curr][next]) {
-          parent[next] = curr;
-          i32 newFlow = std::min(flow, residualCapacity[curr][next]);
-          if (next == t)
-            return newFlow;
-          q.push({next, newFlow});
-        }
-      }
-    }
-    return 0;
+// Octahedral normal encoding: unit n to [-1, 1]^2 and back, decoded again in shader.vs.
+inline glm::vec2 octEncode(const glm::vec3 &n) {
+  float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (l1 == 0.0f) {
+    return glm::vec2(0.0f);
   }
-  // returns indices of vertices in S-part of the flow network
-  std::vector<size_t> mincut(size_t s, size_t t) {
-    std::vector<std::vector<size_t>> paths;
-
-    std::vector<std::vector<i32>> residualCapacity{capacity_};
-    int flow = 0;
-    size_t nVertices = adj_.size();
-    std::vector<size_t> parent(nVertices);
-    int newFlow;
-    while (newFlow = bfs(s, t, parent, residualCapacity)) {
-      flow += newFlow;
-      size_t curr = t;
-      paths.push_back({curr});
-      while (curr != s) {
-        size_t prev = parent[curr];
-        residualCapacity[prev][curr] -= newFlow;
-        residualCapacity[curr][prev] += newFlow;
-        curr = prev;
-        paths.back().push_back(curr);
-      }
-    }
-    std::vector<size_t> sVertices;
-    bfs(s, -1, parent, residualCapacity);
-    for (size_t i = 0; i < nVertices; ++i) {
-      if (parent[i] != -1) {
-        sVertices.push_back(i);
-      }
-    }
-    std::cout << "MOY FLOW ARBALET: " << flow << "\n";
-    return sVertices;
+  glm::vec3 a = n / l1;
+  glm::vec2 e(a.x, a.y);
+  if (a.z < 0.0f) {
+    e = glm::vec2((1.0f - std::abs(a.y)) * (a.x >= 0.0f ? 1.0f : -1.0f),
+                  (1.0f - std::abs(a.x)) * (a.y >= 0.0f ? 1.0f : -1.0f));
   }
-  std::vector<std::vector<size_t>> adj_;
-  std::vector<std::vector<i32>> capacity_;
-};
-/*!todo test
-    math::flownet g = { .adj_ =
-                           {
-                               {1, 4},       // 0
-                               {0, 2, 3, 4}, // 1
-                               {1, 3, 5},    // 2
-                               {1, 2, 4, 5}, // 3
-                               {0, 1, 3},    // 4
-                               {2, 3},       // 5
-                           },
-                       .capacity_ = {
-                           // 0  1  2  3  4  5
-                           {0, 7, 0, 0, 4, 0}, // 0
-                           {0, 0, 5, 3, 0, 0}, // 1
-                           {0, 0, 0, 0, 0, 8}, // 2
-                           {0, 0, 3, 0, 0, 5}, // 3
-                           {0, 3, 0, 2, 0, 0}, // 4
-                           {0, 0, 0, 0, 0, 0}, // 5
-                       }};
-
-    std::vector<size_t> borderVertexIndices = g.mincut(0, 5);
-    for (auto v : borderVertexIndices) {
-      std::cout << v << ", ";
-    }
- * */
+  return e;
+}
+
+inline glm::vec3 octDecode(const glm::vec2 &e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += (n.x >= 0.0f) ? -t : t;
+  n.y += (n.y >= 0.0f) ? -t : t;
+  return glm::normalize(n);
+}
 
 class BBox {
 public:
@@ -292,6 +343,19 @@ public:
     minp.y = std::min(minp.y, p.y);
     minp.z = std::min(minp.z, p.z);
   }
+  void addBox(const BBox &b) {
+    addPoint(b.minp);
+    addPoint(b.maxp);
+  }
+  bool empty() const { return minp.x > maxp.x; }
+  // half the surface area, all the SAH needs
+  float halfArea() const {
+    if (empty()) {
+      return 0.0f;
+    }
+    glm::vec3 d = maxp - minp;
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
 };
 
 } // namespace math
@@ -0,0 +1,291 @@
+#pragma once
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+
+// broc
+#include "brocarena.h"
+#include "broccache.h"
+#include "broccommon.h"
+#include "broccore.h"
+#include "brocmath.h"
+#include "broccurv.h"
+#include "brocflow.h"
+#include "brocload.h"
+#include "brocprof.h"
+#include "brocpyramid.h"
+#include "brocregion.h"
+#include "brocwalker.h"
+
+// openmesh
+#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
+#include <OpenMesh/Core/IO/MeshIO.hh>
+
+namespace brocseg {
+using OpenMeshT = OpenMesh::TriMesh_ArrayKernelT<>;
+
+inline float curvatureToQuality(float curvature) {
+  return 1.0f / std::exp(curvature);
+}
+
+std::vector<glm::vec3> positionsFromMesh(const OpenMeshT &omMesh) {
+  std::vector<glm::vec3> positions(omMesh.n_vertices());
+  for (OpenMeshT::VertexHandle vh : omMesh.vertices()) {
+    OpenMeshT::Point p = omMesh.point(vh);
+    positions[vh.idx()] = glm::vec3(p[0], p[1], p[2]);
+  }
+  return positions;
+}
+
+std::vector<glm::vec3> normalsFromMesh(const OpenMeshT &omMesh) {
+  std::vector<glm::vec3> normals(omMesh.n_vertices());
+  for (OpenMeshT::VertexHandle vh : omMesh.vertices()) {
+    OpenMeshT::Normal n = omMesh.normal(vh);
+    normals[vh.idx()] = glm::vec3(n[0], n[1], n[2]);
+  }
+  return normals;
+}
+
+// vertex indices of every triangle, three per face
+std::vector<u32> trianglesFromMesh(const OpenMeshT &omMesh) {
+  std::vector<u32> indices;
+  indices.reserve(3 * omMesh.n_faces());
+  for (OpenMeshT::FaceHandle fh : omMesh.faces()) {
+    for (OpenMeshT::VertexHandle fv : omMesh.fv_range(fh)) {
+      indices.push_back(fv.idx());
+    }
+  }
+  return indices;
+}
+
+// OpenMesh is only a reader, everything after loading works on the core mesh
+math::coreMesh coreMeshFromOpenMesh(const OpenMeshT &omMesh) {
+  return math::coreMeshFromTriangles(positionsFromMesh(omMesh), normalsFromMesh(omMesh),
+                                     trianglesFromMesh(omMesh));
+}
+
+math::Curvatures computeMeshCurvatures(const math::coreMesh &mesh) {
+  BROC_ZONE("curvature");
+  prof::watch w;
+  math::Curvatures curvatures = math::computeCurvatures(mesh);
+  std::cerr << w.report("curvature") << "\n";
+  return curvatures;
+}
+
+std::vector<float> computePerVertexMeanCurvature(const math::coreMesh &mesh) {
+  return computeMeshCurvatures(mesh).mean;
+}
+
+std::vector<float> energyFromCurvatures(const std::vector<float> &rawCurvatures,
+                                       const math::percentileCache &percentiles, float percentile) {
+  BROC_ZONE("energy");
+  std::vector<float> energy = rawCurvatures;
+  auto [minCurvature, maxCurvature] = percentiles.threshold(percentile);
+
+  float infiniteWeight = 1e8 * energy.size();
+  float minQuality = curvatureToQuality(maxCurvature);
+  float maxQuality = curvatureToQuality(minCurvature);
+  for (size_t i = 0; i < energy.size(); ++i) {
+    float w = curvatureToQuality(energy[i]);
+    energy[i] = w;
+  }
+  return energy;
+}
+
+// topology only, capacities are filled per cut by cutCapacities
+template <typename Cap = i32>
+math::basicFlownet<Cap> flownetFromRing(const math::OneRing &ring) {
+  return math::basicFlownet<Cap>{ring.offsets, ring.vertices};
+}
+
+// 1 / |energy difference| per edge, truncated for integer capacities and kept as they are for
+// floating point ones
+template <typename Cap>
+void cutCapacities(const math::basicFlownet<Cap> &g, const std::vector<float> &energy,
+                   std::span<Cap> capacity) {
+  BROC_ZONE("cutCapacities");
+  const double infinite = math::basicFlownet<Cap>::infiniteCapacity;
+  for (u32 v = 0; v < g.nVertices(); ++v) {
+    for (u32 e = g.rowBeg_[v]; e < g.rowBeg_[v + 1]; ++e) {
+      float e1 = energy[v];
+      float e2 = energy[g.head_[e]];
+      float diff = std::abs(e1 - e2);
+      double weight = (diff > math::EPS) ? (1.0 / diff) : infinite;
+      if (std::abs(e1) > 100 || std::abs(e2) > 100) {
+        weight = 0.0;
+      }
+      capacity[e] = static_cast<Cap>(std::min(weight, infinite));
+    }
+  }
+}
+
+template <typename Cap>
+std::vector<Cap> cutCapacities(const math::basicFlownet<Cap> &g,
+                               const std::vector<float> &energy) {
+  std::vector<Cap> capacity(g.nEdges());
+  cutCapacities(g, energy, std::span<Cap>(capacity));
+  return capacity;
+}
+
+// the S side of a cut after the region cleanup, sorted, in the arena
+std::span<const u32> cleanSelection(const math::OneRing &ring, std::span<const u32> selected,
+                                    std::span<const u32> sources, std::span<const u32> sinks,
+                                    const region::cleanupOptions &options, mem::arena &arena) {
+  std::span<u64> bits = region::fromVertices(ring.nVertices(), selected, arena);
+  region::cleanup(ring, bits, options, sources, sinks, arena);
+  return region::toVertices(bits, arena);
+}
+
+template <typename Cap>
+std::vector<size_t> colorByBorders(math::basicFlownet<Cap> &g, const math::OneRing &ring,
+                                   size_t sIdx, size_t tIdx, const std::vector<float> &energy,
+                                   math::maxflow algorithm = math::maxflow::boykovKolmogorov,
+                                   const region::cleanupOptions &cleanup = {}) {
+  BROC_ZONE("colorByBorders");
+  g.capacity_ = cutCapacities(g, energy);
+  std::vector<size_t> cut = g.mincut(sIdx, tIdx, algorithm);
+  std::vector<u32> selected(cut.begin(), cut.end());
+  mem::arena arena;
+  const u32 source = static_cast<u32>(sIdx);
+  const u32 sink = static_cast<u32>(tIdx);
+  std::span<const u32> result =
+      cleanSelection(ring, selected, {&source, 1}, {&sink, 1}, cleanup, arena);
+  return std::vector<size_t>(result.begin(), result.end());
+}
+
+// Same cut between two seed sets, e.g. brush strokes: the session ties every source to a
+// super-source and every sink to a super-sink through its terminal links. Warm-started from the
+// flow of the previous cut, so adding a stroke re-solves on the same network. Everything
+// transient comes from the session scratch arena, the result stays valid until the next cut.
+std::span<const u32> colorByBorders(math::cutSession &session, const math::OneRing &ring,
+                                    std::span<const u32> sources, std::span<const u32> sinks,
+                                    const std::vector<float> &energy,
+                                    const region::cleanupOptions &cleanup = {}) {
+  BROC_ZONE("colorByBorders");
+  prof::watch w;
+  mem::arena &scratch = session.scratch();
+  scratch.reset();
+  std::span<i32> capacity = scratch.alloc<i32>(session.graph().nEdges());
+  cutCapacities(session.graph(), energy, capacity);
+  session.setCapacities(capacity);
+  session.setSeeds(sources, sinks);
+  std::span<const u32> result =
+      cleanSelection(ring, session.cut(), sources, sinks, cleanup, scratch);
+  std::cerr << "incremental cut took " << w.seconds() << "s\n";
+  return result;
+}
+
+std::span<const u32> colorByBorders(math::cutSession &session, const math::OneRing &ring,
+                                    size_t sIdx, size_t tIdx, const std::vector<float> &energy,
+                                    const region::cleanupOptions &cleanup = {}) {
+  const u32 source = static_cast<u32>(sIdx);
+  const u32 sink = static_cast<u32>(tIdx);
+  return colorByBorders(session, ring, {&source, 1}, {&sink, 1}, energy, cleanup);
+}
+
+// Same cut coarse to fine, on a pyramid built from the cutCapacities of the energy. Scratch and
+// the result come from arena.
+std::span<const u32> colorByBorders(math::multiscaleCut &pyramid, const math::OneRing &ring,
+                                    std::span<const u32> sources, std::span<const u32> sinks,
+                                    mem::arena &arena,
+                                    const region::cleanupOptions &cleanup = {}) {
+  BROC_ZONE("colorByBorders");
+  prof::watch w;
+  std::span<const u32> result = cleanSelection(ring, pyramid.cut(ring, sources, sinks, arena),
+                                               sources, sinks, cleanup, arena);
+  std::cerr << "multiscale cut took " << w.seconds() << "s\n";
+  return result;
+}
+
+std::span<const u32> colorByBorders(math::multiscaleCut &pyramid, const math::OneRing &ring,
+                                    size_t sIdx, size_t tIdx, mem::arena &arena,
+                                    const region::cleanupOptions &cleanup = {}) {
+  const u32 source = static_cast<u32>(sIdx);
+  const u32 sink = static_cast<u32>(tIdx);
+  return colorByBorders(pyramid, ring, {&source, 1}, {&sink, 1}, arena, cleanup);
+}
+
+// labels every vertex in one pass, seeds[k] are the vertices clicked for label k
+std::vector<u32> segmentMultiLabel(math::flownet &g, const std::vector<float> &energy,
+                                   const std::vector<std::vector<u32>> &seeds,
+                                   const std::function<bool()> &stop = {}) {
+  BROC_ZONE("segmentMultiLabel");
+  prof::watch w;
+  std::vector<u32> labels = math::alphaExpansion(g, cutCapacities(g, energy), seeds, 4, stop);
+  std::cerr << w.report("alpha-expansion") << "\n";
+  return labels;
+}
+
+// same labels by random walks, walker.setEnergy() first; warm-started from the potentials of
+// the walker's previous call
+std::vector<u32> segmentRandomWalker(math::randomWalker &walker, const math::OneRing &ring,
+                                     const std::vector<std::vector<u32>> &seeds,
+                                     const std::function<bool()> &stop = {}) {
+  BROC_ZONE("segmentRandomWalker");
+  prof::watch w;
+  std::vector<u32> labels = walker.segment(ring, seeds, {}, stop);
+  std::cerr << w.report("random walker") << ", " << walker.iterations() << " iterations\n";
+  return labels;
+}
+
+OpenMeshT loadMesh(const std::string &pFile) {
+  BROC_ZONE("loadMesh");
+  OpenMeshT mesh;
+  mesh.request_vertex_normals();
+  mesh.request_edge_colors();
+  if (!mesh.has_vertex_normals()) {
+    std::cerr << "normals not available\n";
+  }
+  OpenMesh::IO::Options opt;
+  if (!OpenMesh::IO::read_mesh(mesh, pFile.c_str(), opt)) {
+    std::cerr << "openmesh read error\n";
+    exit(-1);
+  }
+  if (!opt.check(OpenMesh::IO::Options::VertexNormal)) {
+    mesh.request_face_normals();
+    mesh.update_normals();
+    mesh.release_face_normals();
+  }
+  std::cerr << "## n vertices: " << mesh.n_vertices() << "\n";
+  std::cerr << "## n faces: " << mesh.n_faces() << "\n";
+
+  return mesh;
+}
+
+// the fast loader where it reads the format, OpenMesh otherwise
+math::coreMesh loadCoreMesh(const std::string &pFile) {
+  if (std::optional<load::triangleMesh> mesh = load::loadTriangleMesh(pFile)) {
+    std::cerr << "## n vertices: " << mesh->positions.size() << "\n";
+    std::cerr << "## n faces: " << mesh->indices.size() / 3 << "\n";
+    return math::coreMeshFromTriangles(std::move(mesh->positions), std::move(mesh->normals),
+                                       std::move(mesh->indices));
+  }
+  // ascii STL and PLY among others
+  return coreMeshFromOpenMesh(loadMesh(pFile));
+}
+
+// Core mesh and curvatures of pFile from the cache file next to it. A missing or stale cache
+// is rebuilt from the mesh and written back for the next start.
+cache::meshCache loadMeshCached(const std::string &pFile) {
+  BROC_ZONE("loadMeshCached");
+  std::string cachePath = cache::cachePathFor(pFile);
+  std::optional<cache::sourceKey> key = cache::sourceKey::of(pFile);
+  if (key) {
+    if (std::optional<cache::meshCache> cached = cache::meshCache::open(cachePath, *key)) {
+      std::cerr << "## mesh cache: " << cachePath << "\n";
+      return std::move(*cached);
+    }
+  }
+  math::coreMesh mesh = loadCoreMesh(pFile);
+  cache::meshCache built = cache::meshCache::build(key.value_or(cache::sourceKey{}), mesh,
+                                                   computeMeshCurvatures(mesh));
+  if (!key || !built.write(cachePath)) {
+    std::cerr << "could not write mesh cache " << cachePath << "\n";
+  }
+  return built;
+}
+
+} // namespace brocseg
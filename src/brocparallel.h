@@ -0,0 +1,129 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace brocseg {
+namespace par {
+
+inline size_t nThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+// Threads started once and parked between calls. run() hands them task(i) for i in [0, n)
+// through a pointer and a counter, so dispatching allocates nothing. One task at a time: run()
+// returns false when the pool is already busy (a nested call, or one from another thread).
+class workerPool {
+public:
+  explicit workerPool(size_t nWorkers) {
+    workers_.reserve(nWorkers);
+    for (size_t i = 0; i < nWorkers; ++i) {
+      workers_.emplace_back([this] { loop(); });
+    }
+  }
+  workerPool(const workerPool &) = delete;
+  workerPool &operator=(const workerPool &) = delete;
+  ~workerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : workers_) {
+      t.join();
+    }
+  }
+
+  // the calling thread works too, returns once every task(i) has finished
+  template <typename F> bool run(size_t n, F &task) {
+    std::unique_lock<std::mutex> busy(busy_, std::try_to_lock);
+    if (!busy) {
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      call_ = [](void *context, size_t i) { (*static_cast<F *>(context))(i); };
+      context_ = &task;
+      n_ = n;
+      next_.store(0, std::memory_order_relaxed);
+      open_ = true;
+      ++generation_;
+    }
+    wake_.notify_all();
+    work();
+    // every index is taken, wait for the workers still running theirs
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return active_ == 0; });
+    open_ = false;
+    return true;
+  }
+
+private:
+  void work() {
+    for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < n_;) {
+      call_(context_, i);
+    }
+  }
+
+  void loop() {
+    unsigned long long seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || (open_ && generation_ != seen); });
+        if (stop_) {
+          return;
+        }
+        seen = generation_;
+        ++active_;
+      }
+      work();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_ == 0) {
+        idle_.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex busy_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  void (*call_)(void *, size_t) = nullptr;
+  void *context_ = nullptr;
+  size_t n_ = 0;
+  std::atomic<size_t> next_{0};
+  unsigned long long generation_ = 0;
+  size_t active_ = 0;
+  bool open_ = false;
+  bool stop_ = false;
+};
+
+inline workerPool &workers() {
+  static workerPool pool(nThreads() - 1);
+  return pool;
+}
+
+// splits [0, n) into one contiguous chunk per hardware thread and runs f(beg, end) on each,
+// ranges shorter than minChunk stay on the calling thread, as does everything when the pool
+// is busy
+template <typename F> void forChunks(size_t n, F &&f, size_t minChunk = 1024) {
+  size_t nChunks = std::min(nThreads(), (n + minChunk - 1) / minChunk);
+  if (nChunks <= 1) {
+    f(size_t{0}, n);
+    return;
+  }
+  size_t chunk = (n + nChunks - 1) / nChunks;
+  auto task = [&f, n, chunk](size_t c) {
+    size_t beg = std::min(n, c * chunk);
+    f(beg, std::min(n, beg + chunk));
+  };
+  if (!workers().run(nChunks, task)) {
+    f(size_t{0}, n);
+  }
+}
+
+} // namespace par
+} // namespace brocseg
@@ -1,6 +1,24 @@
 #pragma once
 #include <string>
 #include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "broccommon.h"
+
+// BROC_PROFILE=0 compiles every BROC_ZONE / BROC_COUNTER / BROC_FRAME away
+#ifndef BROC_PROFILE
+#define BROC_PROFILE 1
+#endif
+
+#if BROC_PROFILE
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#endif
 
 namespace brocseg {
 namespace prof {
@@ -9,15 +27,243 @@ public:
   watch() {
     beg_ = std::chrono::steady_clock::now();
   }
-  std::string report(const std::string& name) {
+  float seconds() const {
     const auto end = std::chrono::steady_clock::now();
     const std::chrono::duration<float> elapsed_seconds{end - beg_};
-    return name + " took " + std::to_string(elapsed_seconds.count()) + "s";
+    return elapsed_seconds.count();
+  }
+  std::string report(const std::string& name) {
+    return name + " took " + std::to_string(seconds()) + "s";
   }
 
 private:
   std::chrono::time_point<std::chrono::steady_clock> beg_;
 };
 
+enum class recordKind : u8 { zone, counter, frame };
+
+// One profiler event. Names must outlive the profiler, string literals in practice.
+struct record {
+  const char *name;
+  u64 beg; // ns since the profiler started
+  u64 end; // zones: end time, counters: value bits
+  u32 tid; // ring the record came from, threads reuse the rings of finished threads
+  u16 depth;
+  recordKind kind;
+
+  double value() const {
+    double v;
+    std::memcpy(&v, &end, sizeof(v));
+    return v;
+  }
+};
+
+#if BROC_PROFILE
+
+inline u64 now() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                              start)
+      .count();
+}
+
+// Most recent records of one thread. Only the owner writes, anyone may snapshot: slots are
+// relaxed atomics and records overwritten during a snapshot are dropped, never torn.
+class threadRing {
+public:
+  static constexpr u64 capacity = 1 << 14;
+
+  explicit threadRing(u32 tid) : tid(tid), slots_(new slot[capacity]) {}
+
+  void push(const record &r) {
+    u64 h = head_.load(std::memory_order_relaxed);
+    slot &s = slots_[h & (capacity - 1)];
+    s.name.store(r.name, std::memory_order_relaxed);
+    s.beg.store(r.beg, std::memory_order_relaxed);
+    s.end.store(r.end, std::memory_order_relaxed);
+    s.meta.store(r.depth | (u32(r.kind) << 16), std::memory_order_relaxed);
+    head_.store(h + 1, std::memory_order_release);
+  }
+
+  void snapshot(std::vector<record> &out) const {
+    u64 h = head_.load(std::memory_order_acquire);
+    u64 first = (h > capacity) ? h - capacity : 0;
+    size_t base = out.size();
+    for (u64 i = first; i < h; ++i) {
+      const slot &s = slots_[i & (capacity - 1)];
+      u32 meta = s.meta.load(std::memory_order_relaxed);
+      out.push_back({s.name.load(std::memory_order_relaxed),
+                     s.beg.load(std::memory_order_relaxed), s.end.load(std::memory_order_relaxed),
+                     tid, static_cast<u16>(meta & 0xffff), static_cast<recordKind>(meta >> 16)});
+    }
+    // the owner may have lapped the oldest slots while they were copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    u64 h2 = head_.load(std::memory_order_relaxed);
+    u64 intact = (h2 >= capacity) ? h2 - capacity + 1 : 0;
+    if (intact > first) {
+      size_t drop = static_cast<size_t>(std::min(intact, h) - first);
+      out.erase(out.begin() + base, out.begin() + base + drop);
+    }
+  }
+
+  const u32 tid;
+  u16 depth = 0;
+  bool inUse = true;
+
+private:
+  struct slot {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<u64> beg{0};
+    std::atomic<u64> end{0};
+    std::atomic<u32> meta{0};
+  };
+  std::unique_ptr<slot[]> slots_;
+  std::atomic<u64> head_{0};
+};
+
+class registry {
+public:
+  static registry &get() {
+    static registry r;
+    return r;
+  }
+
+  // short-lived worker threads come and go, their rings are handed to the next thread
+  threadRing *acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::unique_ptr<threadRing> &ring : rings_) {
+      if (!ring->inUse) {
+        ring->inUse = true;
+        ring->depth = 0;
+        return ring.get();
+      }
+    }
+    rings_.push_back(std::make_unique<threadRing>(static_cast<u32>(rings_.size())));
+    return rings_.back().get();
+  }
+
+  void release(threadRing *ring) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring->inUse = false;
+  }
+
+  // every record still in the rings, ordered by start time
+  std::vector<record> collect() const {
+    std::vector<record> records;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const std::unique_ptr<threadRing> &ring : rings_) {
+        ring->snapshot(records);
+      }
+    }
+    std::sort(records.begin(), records.end(),
+              [](const record &a, const record &b) { return a.beg < b.beg; });
+    return records;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<threadRing>> rings_;
+};
+
+inline threadRing &localRing() {
+  struct handle {
+    threadRing *ring = registry::get().acquire();
+    ~handle() { registry::get().release(ring); }
+  };
+  thread_local handle h;
+  return *h.ring;
+}
+
+class zone {
+public:
+  explicit zone(const char *name) : name_(name), ring_(localRing()), beg_(now()) {
+    ++ring_.depth;
+  }
+  ~zone() {
+    --ring_.depth;
+    ring_.push({name_, beg_, now(), ring_.tid, ring_.depth, recordKind::zone});
+  }
+  zone(const zone &) = delete;
+  zone &operator=(const zone &) = delete;
+
+private:
+  const char *name_;
+  threadRing &ring_;
+  u64 beg_;
+};
+
+inline void counter(const char *name, double value) {
+  threadRing &ring = localRing();
+  u64 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  ring.push({name, now(), bits, ring.tid, ring.depth, recordKind::counter});
+}
+
+inline void frameMark() {
+  threadRing &ring = localRing();
+  ring.push({"frame", now(), 0, ring.tid, 0, recordKind::frame});
+}
+
+inline std::vector<record> collect() { return registry::get().collect(); }
+
+// Chrome trace event format, opens in chrome://tracing or ui.perfetto.dev
+inline bool writeChromeTrace(const std::string &path) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  auto quoted = [](const char *s) {
+    std::string q = "\"";
+    for (; *s; ++s) {
+      if (*s == '"' || *s == '\\') {
+        q += '\\';
+      }
+      q += *s;
+    }
+    return q + "\"";
+  };
+  // microseconds with ns resolution
+  out << std::fixed << std::setprecision(3);
+  out << "{\"traceEvents\":[\n";
+  bool first = true;
+  for (const record &r : collect()) {
+    out << (first ? "" : ",\n");
+    first = false;
+    out << "{\"name\":" << quoted(r.name) << ",\"pid\":1,\"tid\":" << r.tid
+        << ",\"ts\":" << r.beg / 1000.0;
+    switch (r.kind) {
+    case recordKind::zone:
+      out << ",\"ph\":\"X\",\"dur\":" << (r.end - r.beg) / 1000.0 << "}";
+      break;
+    case recordKind::counter:
+      out << ",\"ph\":\"C\",\"args\":{\"value\":" << r.value() << "}}";
+      break;
+    case recordKind::frame:
+      out << ",\"ph\":\"i\",\"s\":\"g\"}";
+      break;
+    }
+  }
+  out << "\n]}\n";
+  return static_cast<bool>(out);
+}
+
+#define BROC_PROF_CONCAT_(a, b) a##b
+#define BROC_PROF_CONCAT(a, b) BROC_PROF_CONCAT_(a, b)
+#define BROC_ZONE(name) ::brocseg::prof::zone BROC_PROF_CONCAT(brocZone, __LINE__)(name)
+#define BROC_COUNTER(name, value) ::brocseg::prof::counter(name, static_cast<double>(value))
+#define BROC_FRAME() ::brocseg::prof::frameMark()
+
+#else
+
+inline std::vector<record> collect() { return {}; }
+inline bool writeChromeTrace(const std::string &) { return false; }
+
+#define BROC_ZONE(name) ((void)0)
+#define BROC_COUNTER(name, value) ((void)0)
+#define BROC_FRAME() ((void)0)
+
+#endif
+
 } // namespace prof
 } // namespace brocseg
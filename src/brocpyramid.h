@@ -0,0 +1,361 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "brocarena.h"
+#include "broccommon.h"
+#include "broccurv.h"
+#include "brocflow.h"
+#include "brocmath.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace math {
+
+// One coarsening step of a capacitated vertex graph: every vertex of the finer level belongs to
+// exactly one cluster of this one, two clusters are neighbours when any of their members are,
+// and the capacity between them is the sum over the edges between their members. A cut that
+// keeps every cluster whole costs the same on both levels.
+struct pyramidLevel {
+  OneRing ring;
+  std::vector<i32> capacity;        // in ring order
+  std::vector<glm::vec3> positions; // cluster centroids, what the next level is clustered on
+  std::vector<u32> parent;          // finer vertex -> cluster
+  std::vector<u32> childOffsets;    // cluster -> finer vertices, CSR
+  std::vector<u32> children;
+};
+
+// Clusters by a grid over the bounding box, cells twice the average edge length so a level has
+// about a quarter of the vertices of the one below. A cluster only grows along edges in the same
+// cell and stronger than the weakFraction quantile of the capacities: separate surfaces passing
+// through one cell never merge, and a cheap boundary is never swallowed by a cluster, so the
+// coarse cut can still find it.
+inline pyramidLevel clusterLevel(const OneRing &ring, std::span<const glm::vec3> positions,
+                                 std::span<const i32> capacity, float weakFraction) {
+  BROC_ZONE("pyramid level");
+  const u32 n = static_cast<u32>(ring.nVertices());
+  BBox box;
+  double edgeLength = 0.0;
+  for (u32 v = 0; v < n; ++v) {
+    box.addPoint(positions[v]);
+    for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+      edgeLength += glm::length(positions[ring.vertices[i]] - positions[v]);
+    }
+  }
+  edgeLength /= std::max<size_t>(1, ring.vertices.size());
+  const float cell = static_cast<float>(std::max(2.0 * edgeLength, double(EPS)));
+  // 21 bits per axis, cells past that wrap and only split clusters further
+  auto cellOf = [&](u32 v) {
+    glm::vec3 c = (positions[v] - box.minp) / cell;
+    return (u64(c.x) & 0x1fffff) | (u64(c.y) & 0x1fffff) << 21 | (u64(c.z) & 0x1fffff) << 42;
+  };
+  std::vector<u64> cells(n);
+  for (u32 v = 0; v < n; ++v) {
+    cells[v] = cellOf(v);
+  }
+  i32 weak = 0;
+  if (!capacity.empty()) {
+    std::vector<i32> sorted(capacity.begin(), capacity.end());
+    auto nth = sorted.begin() + static_cast<size_t>(weakFraction * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    weak = *nth;
+  }
+
+  pyramidLevel level;
+  const u32 unassigned = std::numeric_limits<u32>::max();
+  level.parent.assign(n, unassigned);
+  std::vector<u32> queue;
+  u32 nClusters = 0;
+  for (u32 seed = 0; seed < n; ++seed) {
+    if (level.parent[seed] != unassigned) {
+      continue;
+    }
+    level.parent[seed] = nClusters;
+    queue.assign(1, seed);
+    for (size_t head = 0; head < queue.size(); ++head) {
+      u32 v = queue[head];
+      for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+        u32 w = ring.vertices[i];
+        if (level.parent[w] == unassigned && cells[w] == cells[seed] && capacity[i] > weak) {
+          level.parent[w] = nClusters;
+          queue.push_back(w);
+        }
+      }
+    }
+    ++nClusters;
+  }
+
+  level.childOffsets.assign(nClusters + 1, 0);
+  for (u32 v = 0; v < n; ++v) {
+    ++level.childOffsets[level.parent[v] + 1];
+  }
+  for (u32 c = 0; c < nClusters; ++c) {
+    level.childOffsets[c + 1] += level.childOffsets[c];
+  }
+  level.children.resize(n);
+  std::vector<u32> fill(level.childOffsets.begin(), level.childOffsets.end() - 1);
+  for (u32 v = 0; v < n; ++v) {
+    level.children[fill[level.parent[v]]++] = v;
+  }
+
+  // one row per cluster, a neighbour gets its edge the first time a member edge reaches it
+  level.positions.assign(nClusters, glm::vec3(0.0f));
+  level.ring.offsets.assign(1, 0);
+  std::vector<i64> sum;
+  std::vector<u32> seen(nClusters, unassigned);
+  std::vector<u32> slot(nClusters);
+  for (u32 c = 0; c < nClusters; ++c) {
+    for (u32 k = level.childOffsets[c]; k < level.childOffsets[c + 1]; ++k) {
+      u32 v = level.children[k];
+      level.positions[c] += positions[v];
+      for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+        u32 d = level.parent[ring.vertices[i]];
+        if (d == c) {
+          continue;
+        }
+        if (seen[d] != c) {
+          seen[d] = c;
+          slot[d] = static_cast<u32>(level.ring.vertices.size());
+          level.ring.vertices.push_back(d);
+          sum.push_back(0);
+        }
+        sum[slot[d]] += capacity[i];
+      }
+    }
+    level.positions[c] /= float(level.childOffsets[c + 1] - level.childOffsets[c]);
+    level.ring.offsets.push_back(static_cast<u32>(level.ring.vertices.size()));
+  }
+  level.capacity.resize(sum.size());
+  for (size_t e = 0; e < sum.size(); ++e) {
+    level.capacity[e] = static_cast<i32>(std::min<i64>(sum[e], flownet::infiniteCapacity));
+  }
+  return level;
+}
+
+// Min cut solved coarse to fine (Lombaert et al., banded graph cut). The pyramid is built once
+// per mesh and energy. A cut is solved on the coarsest level where no cluster holds both a source
+// and a sink; every finer level then starts from the labels of the level above and only
+// the vertices within bandRings rings of the projected boundary are re-solved, with their outer
+// neighbours as seeds. The flow work follows the length of the boundary, not the mesh size,
+// and can miss detail thinner than a coarse cluster that the band does not reach.
+class multiscaleCut {
+public:
+  u32 bandRings = 2;
+
+  multiscaleCut() = default;
+  // ring, positions and edge capacities of the full mesh; coarsening stops below minVertices
+  multiscaleCut(const OneRing &ring, std::span<const glm::vec3> positions,
+                std::span<const i32> capacity, size_t minVertices = 2048,
+                float weakFraction = 0.1f)
+      : capacity_(capacity.begin(), capacity.end()) {
+    BROC_ZONE("pyramid build");
+    const OneRing *finer = &ring;
+    std::span<const glm::vec3> finerPositions = positions;
+    std::span<const i32> finerCapacity = capacity;
+    while (finer->nVertices() > minVertices && levels_.size() < 16) {
+      pyramidLevel level = clusterLevel(*finer, finerPositions, finerCapacity, weakFraction);
+      // a grid that no longer merges anything, e.g. a scattered point set
+      if (3 * level.ring.nVertices() > 2 * finer->nVertices()) {
+        break;
+      }
+      levels_.push_back(std::move(level));
+      finer = &levels_.back().ring;
+      finerPositions = levels_.back().positions;
+      finerCapacity = levels_.back().capacity;
+    }
+  }
+
+  // levels including the full mesh, 0 is the full mesh
+  size_t nLevels() const { return levels_.size() + 1; }
+  size_t nVertices(size_t level) const { return levels_[level - 1].ring.nVertices(); }
+
+  // sorted vertices of the full mesh on the source side, in the arena
+  std::span<u32> cut(const OneRing &ring, std::span<const u32> sources,
+                     std::span<const u32> sinks, mem::arena &arena) {
+    BROC_ZONE("multiscale cut");
+    // the seeds at every level, top is the coarsest one where no cluster holds both kinds
+    std::vector<std::vector<u32>> levelSources(1, {sources.begin(), sources.end()});
+    std::vector<std::vector<u32>> levelSinks(1, {sinks.begin(), sinks.end()});
+    auto clusters = [&](const std::vector<u32> &seeds, size_t l) {
+      std::vector<u32> result;
+      for (u32 v : seeds) {
+        result.push_back(levels_[l - 1].parent[v]);
+      }
+      std::sort(result.begin(), result.end());
+      result.erase(std::unique(result.begin(), result.end()), result.end());
+      return result;
+    };
+    for (size_t l = 1; l < nLevels(); ++l) {
+      std::vector<u32> s = clusters(levelSources.back(), l);
+      std::vector<u32> t = clusters(levelSinks.back(), l);
+      std::vector<u32> both;
+      std::set_intersection(s.begin(), s.end(), t.begin(), t.end(), std::back_inserter(both));
+      if (!both.empty()) {
+        break;
+      }
+      levelSources.push_back(std::move(s));
+      levelSinks.push_back(std::move(t));
+    }
+    const size_t top = levelSources.size() - 1;
+
+    const OneRing &topRing = ringOf(ring, top);
+    std::span<u8> labels = arena.alloc<u8>(topRing.nVertices(), 0);
+    std::span<u8> mark = arena.alloc<u8>(topRing.nVertices(), inside);
+    std::span<u32> all = arena.alloc<u32>(topRing.nVertices());
+    for (u32 v = 0; v < all.size(); ++v) {
+      all[v] = v;
+    }
+    solve(topRing, capacityOf(top), labels, mark, all, {}, levelSources[top], levelSinks[top],
+          arena);
+    std::span<u32> boundary = boundaryOf(topRing, labels, all, arena);
+
+    for (size_t l = top; l-- > 0;) {
+      BROC_ZONE("multiscale band");
+      const pyramidLevel &coarse = levels_[l];
+      const OneRing &fine = ringOf(ring, l);
+      std::span<const u8> coarseLabels = labels;
+      labels = arena.alloc<u8>(fine.nVertices());
+      for (u32 v = 0; v < labels.size(); ++v) {
+        labels[v] = coarseLabels[coarse.parent[v]];
+      }
+      // the band grows ring by ring from the members of the coarse boundary clusters, the
+      // halo is the ring just outside and keeps its labels
+      mark = arena.alloc<u8>(fine.nVertices(), outside);
+      std::span<u32> band = arena.alloc<u32>(fine.nVertices());
+      size_t nBand = 0;
+      for (u32 c : boundary) {
+        for (u32 k = coarse.childOffsets[c]; k < coarse.childOffsets[c + 1]; ++k) {
+          mark[coarse.children[k]] = inside;
+          band[nBand++] = coarse.children[k];
+        }
+      }
+      size_t ringBeg = 0;
+      for (u32 r = 0; r <= bandRings; ++r) {
+        const u8 added = (r < bandRings) ? inside : halo;
+        const size_t ringEnd = nBand;
+        for (size_t i = ringBeg; i < ringEnd; ++i) {
+          u32 v = band[i];
+          for (u32 j = fine.offsets[v]; j < fine.offsets[v + 1]; ++j) {
+            u32 w = fine.vertices[j];
+            if (mark[w] == outside) {
+              mark[w] = added;
+              band[nBand++] = w;
+            }
+          }
+        }
+        ringBeg = ringEnd;
+      }
+      std::span<u32> region = band.first(nBand);
+      solve(fine, capacityOf(l), labels, mark, region, region.subspan(ringBeg), levelSources[l],
+            levelSinks[l], arena);
+      boundary = boundaryOf(fine, labels, region, arena);
+    }
+
+    size_t count = 0;
+    for (u8 label : labels) {
+      count += label;
+    }
+    std::span<u32> result = arena.alloc<u32>(count);
+    size_t i = 0;
+    for (u32 v = 0; v < labels.size(); ++v) {
+      if (labels[v]) {
+        result[i++] = v;
+      }
+    }
+    return result;
+  }
+
+private:
+  // band membership while a level is solved
+  static constexpr u8 outside = 0;
+  static constexpr u8 inside = 1;
+  static constexpr u8 halo = 2;
+
+  const OneRing &ringOf(const OneRing &ring, size_t level) const {
+    return level == 0 ? ring : levels_[level - 1].ring;
+  }
+  std::span<const i32> capacityOf(size_t level) const {
+    return level == 0 ? std::span<const i32>(capacity_) : levels_[level - 1].capacity;
+  }
+
+  // Relabels the inside vertices of region (inside and halo vertices, halo ones in haloPart)
+  // by a cut of the subgraph they span, halo vertices seeded with their current label and
+  // inside ones by the seeds of the level.
+  static void solve(const OneRing &ring, std::span<const i32> capacity, std::span<u8> labels,
+                    std::span<const u8> mark, std::span<const u32> region,
+                    std::span<const u32> haloPart, std::span<const u32> seedSources,
+                    std::span<const u32> seedSinks, mem::arena &arena) {
+    std::span<u32> local = arena.alloc<u32>(ring.nVertices());
+    for (u32 i = 0; i < region.size(); ++i) {
+      local[region[i]] = i;
+    }
+    std::vector<u32> rowBeg(1, 0);
+    std::vector<u32> head;
+    std::vector<i32> subCapacity;
+    rowBeg.reserve(region.size() + 1);
+    for (u32 v : region) {
+      for (u32 j = ring.offsets[v]; j < ring.offsets[v + 1]; ++j) {
+        u32 w = ring.vertices[j];
+        if (mark[w] != outside) {
+          head.push_back(local[w]);
+          subCapacity.push_back(capacity[j]);
+        }
+      }
+      rowBeg.push_back(static_cast<u32>(head.size()));
+    }
+    std::vector<u32> sources;
+    std::vector<u32> sinks;
+    for (u32 v : haloPart) {
+      (labels[v] ? sources : sinks).push_back(local[v]);
+    }
+    for (u32 v : seedSources) {
+      if (mark[v] == inside) {
+        sources.push_back(local[v]);
+      }
+    }
+    for (u32 v : seedSinks) {
+      if (mark[v] == inside) {
+        sinks.push_back(local[v]);
+      }
+    }
+    cutSession session{flownet{std::move(rowBeg), std::move(head)}};
+    session.setCapacities(subCapacity);
+    session.setSeeds(sources, sinks);
+    for (u32 v : region) {
+      if (mark[v] == inside) {
+        labels[v] = 0;
+      }
+    }
+    for (u32 i : session.cut()) {
+      if (mark[region[i]] == inside) {
+        labels[region[i]] = 1;
+      }
+    }
+  }
+
+  // the vertices of candidates with a neighbour on the other side
+  static std::span<u32> boundaryOf(const OneRing &ring, std::span<const u8> labels,
+                                   std::span<const u32> candidates, mem::arena &arena) {
+    std::span<u32> boundary = arena.alloc<u32>(candidates.size());
+    size_t count = 0;
+    for (u32 v : candidates) {
+      for (u32 j = ring.offsets[v]; j < ring.offsets[v + 1]; ++j) {
+        if (labels[ring.vertices[j]] != labels[v]) {
+          boundary[count++] = v;
+          break;
+        }
+      }
+    }
+    return boundary.first(count);
+  }
+
+  std::vector<pyramidLevel> levels_;
+  std::vector<i32> capacity_; // of the full mesh
+};
+
+} // namespace math
+} // namespace brocseg
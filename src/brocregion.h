@@ -0,0 +1,239 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <limits>
+#include <span>
+#include <utility>
+
+#include "brocarena.h"
+#include "broccommon.h"
+#include "broccurv.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+
+namespace brocseg {
+namespace region {
+
+// Vertex sets are dense bitsets, vertex v is bit v % 64 of word v / 64. Passes write whole
+// words, so parallel chunks never share one, and read neighbours through the one-ring: O(E).
+
+constexpr u32 noComponent = std::numeric_limits<u32>::max();
+
+inline size_t nWords(size_t nVertices) { return (nVertices + 63) / 64; }
+inline bool test(std::span<const u64> bits, u32 v) { return (bits[v >> 6] >> (v & 63)) & 1; }
+inline void set(std::span<u64> bits, u32 v) { bits[v >> 6] |= u64{1} << (v & 63); }
+inline void reset(std::span<u64> bits, u32 v) { bits[v >> 6] &= ~(u64{1} << (v & 63)); }
+
+// out[v] = member(v) for every vertex; member may read out only at v itself
+template <typename F> void vertexPass(size_t nVertices, std::span<u64> out, F member) {
+  par::forChunks(nWords(nVertices), [&](size_t beg, size_t end) {
+    for (size_t w = beg; w < end; ++w) {
+      const u32 first = static_cast<u32>(64 * w);
+      const u32 last = static_cast<u32>(std::min<size_t>(nVertices, first + 64));
+      u64 word = 0;
+      for (u32 v = first; v < last; ++v) {
+        word |= u64{member(v)} << (v - first);
+      }
+      out[w] = word;
+    }
+  }, 16);
+}
+
+// in plus every vertex with a neighbour in it
+inline void dilate(const math::OneRing &ring, std::span<const u64> in, std::span<u64> out) {
+  vertexPass(ring.nVertices(), out, [&](u32 v) {
+    if (test(in, v)) {
+      return true;
+    }
+    for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+      if (test(in, ring.vertices[i])) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+// the vertices of in whose neighbours are all in it
+inline void erode(const math::OneRing &ring, std::span<const u64> in, std::span<u64> out) {
+  vertexPass(ring.nVertices(), out, [&](u32 v) {
+    if (!test(in, v)) {
+      return false;
+    }
+    for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+      if (!test(in, ring.vertices[i])) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+// closing: gaps up to 2 * iterations rings wide are bridged, the outline stays put
+inline void close(const math::OneRing &ring, std::span<u64> bits, u32 iterations,
+                  mem::arena &arena) {
+  BROC_ZONE("region close");
+  std::span<u64> src = bits;
+  std::span<u64> dst = arena.alloc<u64>(bits.size());
+  for (u32 i = 0; i < 2 * iterations; ++i) {
+    if (i < iterations) {
+      dilate(ring, src, dst);
+    } else {
+      erode(ring, src, dst);
+    }
+    std::swap(src, dst);
+  }
+  // an even number of passes always ends back in bits
+}
+
+// opening: parts thinner than 2 * iterations rings are cut off
+inline void open(const math::OneRing &ring, std::span<u64> bits, u32 iterations,
+                 mem::arena &arena) {
+  BROC_ZONE("region open");
+  std::span<u64> src = bits;
+  std::span<u64> dst = arena.alloc<u64>(bits.size());
+  for (u32 i = 0; i < 2 * iterations; ++i) {
+    if (i < iterations) {
+      erode(ring, src, dst);
+    } else {
+      dilate(ring, src, dst);
+    }
+    std::swap(src, dst);
+  }
+}
+
+// Connected components of the vertices whose bit equals value, numbered 0.. in order of their
+// smallest vertex; noComponent for the others. Returns the number of components. Edges are
+// united in parallel by a lock-free union-find that always links the larger root under the
+// smaller, so a root is the smallest vertex of its tree.
+inline u32 components(const math::OneRing &ring, std::span<const u64> bits, bool value,
+                      std::span<u32> label) {
+  BROC_ZONE("region components");
+  const u32 n = static_cast<u32>(ring.nVertices());
+  auto parent = [&](u32 v) { return std::atomic_ref<u32>(label[v]); };
+  auto find = [&](u32 v) {
+    for (u32 p; (p = parent(v).load(std::memory_order_relaxed)) != v;) {
+      // path halving, any ancestor is a valid parent
+      u32 grandparent = parent(p).load(std::memory_order_relaxed);
+      parent(v).store(grandparent, std::memory_order_relaxed);
+      v = grandparent;
+    }
+    return v;
+  };
+  par::forChunks(n, [&](size_t beg, size_t end) {
+    for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+      label[v] = v;
+    }
+  });
+  par::forChunks(n, [&](size_t beg, size_t end) {
+    for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+      if (test(bits, v) != value) {
+        continue;
+      }
+      for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+        u32 a = v;
+        u32 b = ring.vertices[i];
+        if (b > a || test(bits, b) != value) {
+          continue;
+        }
+        while ((a = find(a)) != (b = find(b))) {
+          if (a < b) {
+            std::swap(a, b);
+          }
+          u32 expected = a;
+          if (parent(a).compare_exchange_weak(expected, b, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+      }
+    }
+  });
+  par::forChunks(n, [&](size_t beg, size_t end) {
+    for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+      label[v] = find(v);
+    }
+  });
+  // roots come before the rest of their component
+  u32 count = 0;
+  for (u32 v = 0; v < n; ++v) {
+    if (test(bits, v) != value) {
+      label[v] = noComponent;
+    } else {
+      label[v] = (label[v] == v) ? count++ : label[label[v]];
+    }
+  }
+  return count;
+}
+
+// flips the components of value smaller than minSize, unless they hold a vertex of keep
+inline void removeSmall(const math::OneRing &ring, std::span<u64> bits, bool value, u32 minSize,
+                        std::span<const u32> keep, mem::arena &arena) {
+  BROC_ZONE("region removeSmall");
+  const size_t n = ring.nVertices();
+  std::span<u32> label = arena.alloc<u32>(n);
+  u32 count = components(ring, bits, value, label);
+  std::span<u32> size = arena.alloc<u32>(count, 0);
+  for (u32 l : label) {
+    if (l != noComponent) {
+      ++size[l];
+    }
+  }
+  for (u32 v : keep) {
+    if (label[v] != noComponent) {
+      size[label[v]] = minSize;
+    }
+  }
+  vertexPass(n, bits, [&](u32 v) {
+    return (label[v] != noComponent && size[label[v]] < minSize) ? !value : test(bits, v);
+  });
+}
+
+struct cleanupOptions {
+  u32 closeIterations = 1; // rings of closing before the components are counted
+  u32 minComponent = 32;   // smaller islands are dropped and smaller holes filled, in vertices
+};
+
+// Post-processing of a cut: closing, then islands without a source and holes without a sink
+// below options.minComponent are flipped. Sources stay in, sinks stay out.
+inline void cleanup(const math::OneRing &ring, std::span<u64> bits, const cleanupOptions &options,
+                    std::span<const u32> sources, std::span<const u32> sinks, mem::arena &arena) {
+  BROC_ZONE("region cleanup");
+  close(ring, bits, options.closeIterations, arena);
+  removeSmall(ring, bits, true, options.minComponent, sources, arena);
+  removeSmall(ring, bits, false, options.minComponent, sinks, arena);
+  for (u32 v : sources) {
+    set(bits, v);
+  }
+  for (u32 v : sinks) {
+    reset(bits, v);
+  }
+}
+
+inline std::span<u64> fromVertices(size_t nVertices, std::span<const u32> vertices,
+                                   mem::arena &arena) {
+  std::span<u64> bits = arena.alloc<u64>(nWords(nVertices), 0);
+  for (u32 v : vertices) {
+    set(bits, v);
+  }
+  return bits;
+}
+
+// the members in increasing order
+inline std::span<u32> toVertices(std::span<const u64> bits, mem::arena &arena) {
+  size_t count = 0;
+  for (u64 word : bits) {
+    count += std::popcount(word);
+  }
+  std::span<u32> vertices = arena.alloc<u32>(count);
+  size_t i = 0;
+  for (size_t w = 0; w < bits.size(); ++w) {
+    for (u64 word = bits[w]; word != 0; word &= word - 1) {
+      vertices[i++] = static_cast<u32>(64 * w + std::countr_zero(word));
+    }
+  }
+  return vertices;
+}
+
+} // namespace region
+} // namespace brocseg
@@ -1,8 +1,16 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "broccommon.h"
 #include "brocmath.h"
+#include "brocprof.h"
 // sdl + opengl
 #include <glad/glad.h>
 #include <SDL2/SDL.h>
@@ -75,6 +83,10 @@ public:
   void uniform3fv(const char *name, const glm::vec3 &v) {
     glUniform3fv(glGetUniformLocation(id_, name), 1, &v[0]);
   }
+  void uniform2fv(const char *name, const glm::vec2 &v) {
+    glUniform2fv(glGetUniformLocation(id_, name), 1, &v[0]);
+  }
+  void uniform1i(const char *name, int v) { glUniform1i(glGetUniformLocation(id_, name), v); }
   void useProgram() const { glUseProgram(id_); }
 
 private:
@@ -208,20 +220,47 @@ public:
   }
 };
 
+// Positions and normals go into an immutable buffer once, packed into 12 bytes: positions as
+// 16 bits per axis across the bounding box, normals octahedral in two 16-bit snorms. Colour
+// comes from two more streams the vertex shader maps to rgb: a scalar field, normalised by the
+// fieldRange uniform, and a label byte, 0 for none, that picks a palette entry and wins over
+// the field. Labels only send the ranges touched since the last sendLabels(); a whole label
+// array built elsewhere, e.g. on a worker thread, is swapped in by swapLabels().
 class Mesh {
 public:
   class Vertex {
   public:
-    glm::vec3 pos;
-    glm::vec3 normal;
-    glm::vec3 color;
+    u16 pos[3]; // posOrigin + pos / 65535 * posExtent
+    u16 pad;
+    i16 normal[2]; // octahedral, snorm
   };
-
-  Mesh(const std::string &name) : name_(name) {
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
+  static_assert(sizeof(Vertex) == 12);
+
+  static constexpr u8 noLabel = 0;
+
+  Mesh(const std::string &name) : name_(name) {}
+  Mesh(const Mesh &) = delete;
+  Mesh &operator=(const Mesh &) = delete;
+  Mesh(Mesh &&other) noexcept { *this = std::move(other); }
+  Mesh &operator=(Mesh &&other) noexcept {
+    std::swap(vao, other.vao);
+    std::swap(vbo, other.vbo);
+    std::swap(fbo, other.fbo);
+    std::swap(lbo, other.lbo);
+    std::swap(ebo, other.ebo);
+    vertices = std::move(other.vertices);
+    field = std::move(other.field);
+    labels = std::move(other.labels);
+    indices = std::move(other.indices);
+    posOrigin = other.posOrigin;
+    posExtent = other.posExtent;
+    fieldRange = other.fieldRange;
+    showField = other.showField;
+    name_ = std::move(other.name_);
+    dirty_ = std::move(other.dirty_);
+    return *this;
   }
+  ~Mesh() { releaseGl(); }
 
   void draw() const {
     glBindVertexArray(vao);
@@ -229,33 +268,315 @@ public:
     glBindVertexArray(0);
   }
 
+  // quantises the geometry, the box is kept for decoding
+  void setGeometry(std::span<const glm::vec3> positions, std::span<const glm::vec3> normals) {
+    brocseg::math::BBox box;
+    for (const glm::vec3 &p : positions) {
+      box.addPoint(p);
+    }
+    posOrigin = box.minp;
+    posExtent = box.maxp - box.minp;
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; ++axis) {
+      scale[axis] = (posExtent[axis] > 0.0f) ? 65535.0f / posExtent[axis] : 0.0f;
+    }
+    vertices.resize(positions.size());
+    for (size_t v = 0; v < positions.size(); ++v) {
+      glm::vec3 q = (positions[v] - posOrigin) * scale;
+      glm::vec2 e = brocseg::math::octEncode(normals[v]);
+      Vertex &vertex = vertices[v];
+      for (int axis = 0; axis < 3; ++axis) {
+        vertex.pos[axis] = static_cast<u16>(std::lround(q[axis]));
+      }
+      vertex.pad = 0;
+      vertex.normal[0] = static_cast<i16>(std::lround(e.x * 32767.0f));
+      vertex.normal[1] = static_cast<i16>(std::lround(e.y * 32767.0f));
+    }
+  }
+
+  // full upload, for a new or reshaped mesh; immutable storage cannot be respecified, so the
+  // buffers are created anew
   void sendGl() {
+    BROC_ZONE("sendGl");
+    releaseGl();
+    GLuint buffers[4];
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(4, buffers);
+    vbo = buffers[0];
+    fbo = buffers[1];
+    lbo = buffers[2];
+    ebo = buffers[3];
     glBindVertexArray(vao);
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(),
-                 GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), &indices[0],
-                 GL_STATIC_DRAW);
-
+    glBufferStorage(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(), 0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex), (void *)0);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(Vertex),
                           (void *)offsetof(Vertex, normal));
+
+    field.resize(vertices.size(), 0.0f);
+    glBindBuffer(GL_ARRAY_BUFFER, fbo);
+    glBufferStorage(GL_ARRAY_BUFFER, field.size() * sizeof(field[0]), field.data(),
+                    GL_DYNAMIC_STORAGE_BIT);
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, color));
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
+
+    labels.resize(vertices.size(), noLabel);
+    glBindBuffer(GL_ARRAY_BUFFER, lbo);
+    glBufferStorage(GL_ARRAY_BUFFER, labels.size() * sizeof(labels[0]), labels.data(),
+                    GL_DYNAMIC_STORAGE_BIT);
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, sizeof(u8), (void *)0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(),
+                    0);
+    glBindVertexArray(0);
+    dirty_.assign((labels.size() + dirtyBlock - 1) / dirtyBlock, 0);
+  }
+
+  // replaces the whole scalar field, e.g. with freshly computed curvatures
+  void setField(const std::vector<float> &values) {
+    BROC_ZONE("setField");
+    field = values;
+    if (fbo != 0) {
+      glBindBuffer(GL_ARRAY_BUFFER, fbo);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, field.size() * sizeof(field[0]), field.data());
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+  }
+
+  // field values in [m, M] span the colormap, values outside are clamped
+  void setFieldRange(float m, float M) {
+    fieldRange = glm::vec2(m, M);
+    showField = true;
+  }
+
+  // palette entries repeat every 12 labels, see labelHue in shader.vs
+  static u8 labelCode(size_t label) { return static_cast<u8>(label % 12 + 1); }
+
+  void setLabel(size_t v, size_t label) { setLabelCode(v, labelCode(label)); }
+
+  // a code as stored in labels, 0 for none
+  void setLabelCode(size_t v, u8 code) {
+    labels[v] = code;
+    if (!dirty_.empty()) {
+      dirty_[v / dirtyBlock] = 1;
+    }
+  }
+
+  // exchanges the label array with other, same size, and marks the blocks that differ
+  void swapLabels(std::vector<u8> &other) {
+    BROC_ZONE("swapLabels");
+    labels.swap(other);
+    for (size_t b = 0; b < dirty_.size(); ++b) {
+      size_t first = b * dirtyBlock;
+      size_t count = std::min(dirtyBlock, labels.size() - first);
+      if (std::memcmp(labels.data() + first, other.data() + first, count) != 0) {
+        dirty_[b] = 1;
+      }
+    }
+  }
+
+  // uploads runs of dirty blocks, traffic follows the relabelled vertices
+  void sendLabels() {
+    BROC_ZONE("sendLabels");
+    if (lbo == 0) {
+      return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, lbo);
+    for (size_t b = 0; b < dirty_.size();) {
+      if (!dirty_[b]) {
+        ++b;
+        continue;
+      }
+      size_t run = b;
+      while (run < dirty_.size() && dirty_[run]) {
+        dirty_[run++] = 0;
+      }
+      size_t first = b * dirtyBlock;
+      size_t last = std::min(run * dirtyBlock, labels.size());
+      glBufferSubData(GL_ARRAY_BUFFER, first, last - first, labels.data() + first);
+      b = run;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // uniforms of shader.vs that belong to this mesh
+  void setUniforms(ShaderProgram &shader) const {
+    shader.uniform3fv("posOrigin", posOrigin);
+    shader.uniform3fv("posExtent", posExtent);
+    shader.uniform2fv("fieldRange", fieldRange);
+    shader.uniform1i("showField", showField ? 1 : 0);
   }
 
   const char *getName() const { return name_.c_str(); }
 
-  GLuint vao, vbo, ebo;
+  GLuint vao = 0, vbo = 0, fbo = 0, lbo = 0, ebo = 0;
   std::vector<Vertex> vertices;
+  std::vector<float> field;
+  std::vector<u8> labels; // noLabel or palette entry + 1
   std::vector<u32> indices;
+  glm::vec3 posOrigin = glm::vec3(0.0f);
+  glm::vec3 posExtent = glm::vec3(0.0f);
+  glm::vec2 fieldRange = glm::vec2(0.0f, 1.0f);
+  bool showField = false; // plain grey where there is no label until a range is set
   std::string name_;
+
+private:
+  // vertices per dirty flag
+  static constexpr size_t dirtyBlock = 1024;
+
+  void releaseGl() {
+    if (vao != 0) {
+      GLuint buffers[] = {vbo, fbo, lbo, ebo};
+      glDeleteBuffers(4, buffers);
+      glDeleteVertexArrays(1, &vao);
+      vao = vbo = fbo = lbo = ebo = 0;
+    }
+  }
+
+  std::vector<u8> dirty_;
+};
+
+// Profiler window: frame times of the recent frames and a flame graph of the last complete
+// frame, one band per profiler thread ring.
+class ProfilerOverlay {
+public:
+  void draw(bool *open) {
+    if (!ImGui::Begin("profiler", open)) {
+      ImGui::End();
+      return;
+    }
+#if !BROC_PROFILE
+    ImGui::Text("profiler compiled out, build with BROC_PROFILE=1");
+    ImGui::End();
+    return;
+#endif
+    ImGui::Checkbox("pause", &paused_);
+    ImGui::SameLine();
+    if (ImGui::Button("export trace")) {
+      exported_ = brocseg::prof::writeChromeTrace(tracePath) ? tracePath : "export failed";
+    }
+    if (!exported_.empty()) {
+      ImGui::SameLine();
+      ImGui::Text("%s", exported_.c_str());
+    }
+    if (!paused_) {
+      records_ = brocseg::prof::collect();
+    }
+
+    std::vector<u64> frames;
+    for (const brocseg::prof::record &r : records_) {
+      if (r.kind == brocseg::prof::recordKind::frame) {
+        frames.push_back(r.beg);
+      }
+    }
+    if (frames.size() < 2) {
+      ImGui::Text("waiting for frames");
+      ImGui::End();
+      return;
+    }
+    frameMs_.clear();
+    for (size_t i = (frames.size() > historySize) ? frames.size() - historySize : 1;
+         i < frames.size(); ++i) {
+      frameMs_.push_back((frames[i] - frames[i - 1]) / 1e6f);
+    }
+    ImGui::PlotLines("frame ms", frameMs_.data(), static_cast<int>(frameMs_.size()), 0, nullptr,
+                     0.0f, 3.4e38f, ImVec2(0.0f, 60.0f));
+
+    drawFlameGraph(frames[frames.size() - 2], frames.back());
+    drawCounters();
+    ImGui::End();
+  }
+
+private:
+  static constexpr size_t historySize = 240;
+  static constexpr const char *tracePath = "brocseg_trace.json";
+
+  static ImU32 colorOf(const char *name) {
+    u32 hash = 2166136261u;
+    for (; *name; ++name) {
+      hash = (hash ^ static_cast<u8>(*name)) * 16777619u;
+    }
+    glm::vec3 c = brocseg::math::rgbFromHsv((hash % 360) / 360.0f, 0.55f, 0.85f);
+    return IM_COL32(c.x * 255, c.y * 255, c.z * 255, 255);
+  }
+
+  void drawFlameGraph(u64 frameBeg, u64 frameEnd) {
+    const float rowHeight = 18.0f;
+    const float span = static_cast<float>(frameEnd - frameBeg);
+    // one band per ring that has zones in the frame, as deep as its deepest zone
+    std::vector<int> laneDepth;
+    for (const brocseg::prof::record &r : records_) {
+      if (r.kind == brocseg::prof::recordKind::zone && r.end > frameBeg && r.beg < frameEnd) {
+        if (laneDepth.size() <= r.tid) {
+          laneDepth.resize(r.tid + 1, 0);
+        }
+        laneDepth[r.tid] = std::max(laneDepth[r.tid], r.depth + 1);
+      }
+    }
+    std::vector<float> laneY(laneDepth.size(), 0.0f);
+    float height = 0.0f;
+    for (size_t lane = 0; lane < laneDepth.size(); ++lane) {
+      laneY[lane] = height;
+      height += laneDepth[lane] ? (laneDepth[lane] * rowHeight + 4.0f) : 0.0f;
+    }
+
+    ImGui::Text("last frame %.3f ms", span / 1e6f);
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(1.0f, ImGui::GetContentRegionAvail().x);
+    for (const brocseg::prof::record &r : records_) {
+      if (r.kind != brocseg::prof::recordKind::zone || r.end <= frameBeg || r.beg >= frameEnd) {
+        continue;
+      }
+      float x0 = origin.x + (std::max(r.beg, frameBeg) - frameBeg) / span * width;
+      float x1 = origin.x + (std::min(r.end, frameEnd) - frameBeg) / span * width;
+      float y0 = origin.y + laneY[r.tid] + r.depth * rowHeight;
+      ImVec2 lo(x0, y0);
+      ImVec2 hi(std::max(x1, x0 + 1.0f), y0 + rowHeight - 1.0f);
+      drawList->AddRectFilled(lo, hi, colorOf(r.name));
+      if (hi.x - lo.x > 30.0f) {
+        drawList->PushClipRect(lo, hi, true);
+        drawList->AddText(ImVec2(x0 + 2.0f, y0 + 1.0f), IM_COL32(0, 0, 0, 255), r.name);
+        drawList->PopClipRect();
+      }
+      if (ImGui::IsMouseHoveringRect(lo, hi)) {
+        ImGui::SetTooltip("%s: %.3f ms", r.name, (r.end - r.beg) / 1e6);
+      }
+    }
+    ImGui::Dummy(ImVec2(width, height));
+  }
+
+  void drawCounters() {
+    // latest value of every counter, records are ordered by time
+    std::vector<const brocseg::prof::record *> latest;
+    for (const brocseg::prof::record &r : records_) {
+      if (r.kind != brocseg::prof::recordKind::counter) {
+        continue;
+      }
+      auto it = std::find_if(latest.begin(), latest.end(), [&r](const brocseg::prof::record *c) {
+        return std::strcmp(c->name, r.name) == 0;
+      });
+      if (it == latest.end()) {
+        latest.push_back(&r);
+      } else {
+        *it = &r;
+      }
+    }
+    for (const brocseg::prof::record *c : latest) {
+      ImGui::Text("%s: %g", c->name, c->value());
+    }
+  }
+
+  bool paused_ = false;
+  std::string exported_;
+  std::vector<brocseg::prof::record> records_;
+  std::vector<float> frameMs_;
 };
 
 } // namespace broc
+
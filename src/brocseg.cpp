@@ -1,273 +1,423 @@
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <cmath>
-#include <unordered_set>
 
 // broc
 #include "broccommon.h"
 #include "brocmath.h"
+#include "brocbvh.h"
+#include "brocflow.h"
+#include "brocjobs.h"
+#include "brocmesh.h"
 #include "brocprof.h"
 #include "brocrender.h"
 
 // imgui
 #include <imgui.h>
 
-// openmesh
-#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
-#include <OpenMesh/Core/IO/MeshIO.hh>
-
 using u32 = uint32_t;
 
 namespace brocseg {
-using OpenMeshT = OpenMesh::TriMesh_ArrayKernelT<>;
 
 struct Scene {
-  OpenMeshT omMesh;
-  broc::Mesh brocMesh;
+  math::coreMesh mesh; // what everything below is built from
+  broc::Mesh brocMesh{""};
+  math::bvh bvh; // over mesh positions, rebuilt whenever they move
+  // only jobs touch the session and read the rest of the mesh data once the scene is loaded
+  math::cutSession session;
+  std::vector<float> rawCurvatures;
+  math::percentileCache curvaturePercentiles;
+  math::maxflow maxflow = math::maxflow::boykovKolmogorov;
+  // coarse to fine cuts, on a pyramid built for the energy at pyramidPercentile
+  bool coarseToFine = false;
+  math::multiscaleCut pyramid;
+  float pyramidPercentile = -1.0f;
+  region::cleanupOptions cleanup;
   std::vector<size_t> selectedVertexIndices;
-  float percentile;
+  // brush mode: a drag paints a source stroke, with ctrl a sink stroke, and every finished stroke
+  // re-solves the current segment from all of its strokes; "new segment" starts the next one
+  bool brush = false;
+  int brushRings = 1;
+  std::vector<u32> stroke; // the one being drawn
+  bool strokeIsSink = false;
+  std::vector<u32> brushSources;
+  std::vector<u32> brushSinks;
+  std::optional<size_t> brushLabel; // of the current segment, none before its first stroke
+  std::vector<u8> brushBase;        // labels under the current segment
+  std::vector<u32> brushPainted;    // what it shows: its last cut and the strokes since
+  u32 brushSegment = 0;             // counts "new segment" presses
+  std::shared_ptr<jobs::token> brushJob; // the segment's re-cut in flight
+  float percentile = 0.9f;
+  // multi-label mode: clicks add seeds for currentLabel, "segment" labels the whole mesh
+  bool multiLabel = false;
+  // by random walks instead of alpha-expansion, with weights for the energy at walkerPercentile
+  bool randomWalk = false;
+  math::randomWalker walker;
+  float walkerPercentile = -1.0f;
+  int currentLabel = 0;
+  std::vector<std::vector<u32>> labelSeeds;
+  // the label job started last, the multi-label segmentation in flight and the spare label
+  // array the next segmentation fills
+  std::shared_ptr<jobs::token> labelJob;
+  std::shared_ptr<jobs::token> segmentJob;
+  std::vector<u8> labelBack;
+  bool loaded = false;
 };
 
-inline float curvatureToQuality(float curvature) {
-  return 1.0f / std::exp(curvature);
+// The field itself is on the gpu already, only the colormap range changes.
+// approximate while the percentile slider is being dragged, exact once it is released
+void colorBy(broc::Mesh &brocMesh, const math::percentileCache &percentiles, float percentile,
+             bool approximate = false) {
+  BROC_ZONE("colorBy");
+  auto [m, M] = approximate ? percentiles.approximateThreshold(percentile)
+                            : percentiles.threshold(percentile);
+  brocMesh.setFieldRange(m, M);
 }
 
-void normalize(std::vector<float> &arr, float percentile) {
-  prof::watch percentileWatch;
-  auto [m, M] = math::percentileThreshold(arr, percentile);
-  std::cout << percentile << " percentile: [" << m << ", " << M << "]\n";
-  std::cout << percentileWatch.report("percentile calculation") << "\n";
+math::bvh bvhFromMesh(const math::coreMesh &mesh) {
+  prof::watch w;
+  math::bvh result{mesh.positions, mesh.indices};
+  std::cerr << w.report("bvh build") << "\n";
+  return result;
+}
 
-  for (auto &c : arr) {
-    c = std::clamp(c, m, M);
-    c = math::remap(c, m, M, 0.0f, 1.0f);
-    c = std::clamp(c, 0.0f, 1.0f);
-  }
+broc::Mesh convert(const math::coreMesh &mesh, const std::string &name) {
+  broc::Mesh brocMesh{name};
+  brocMesh.setGeometry(mesh.positions, mesh.normals);
+  brocMesh.indices = mesh.indices;
+  return brocMesh;
 }
 
-void colorBy(broc::Mesh &brocMesh, const std::vector<float> &source, float percentile) {
-  return;
-  std::vector<float> normalizedSource{source};
-  normalize(normalizedSource, percentile);
-  for (int vIdx = 0; vIdx < brocMesh.vertices.size(); ++vIdx) {
-    brocMesh.vertices[vIdx].color = math::colorFromNormalized(normalizedSource[vIdx]);
-  }
-  brocMesh.sendGl();
+glm::vec3 mouseToWorldDir(const glm::ivec2 &mouse, const broc::Camera &camera) {
+  float x = (2.0f * mouse.x) / camera.screenWidth - 1.0f;
+  float y = 1.0f - (2.0f * mouse.y) / camera.screenHeight;
+  float z = 1.0f;
+  glm::vec4 rayClip = glm::vec4(x, y, -1.0, 1.0);
+  glm::vec4 rayEye = glm::inverse(camera.projM) * rayClip;
+  rayEye.w = 0.0;
+
+  glm::vec4 tmp = glm::inverse(camera.viewM) * rayEye;
+  glm::vec3 rayWorld = glm::vec3(tmp.x, tmp.y, tmp.z);
+  rayWorld = glm::normalize(rayWorld);
+  return rayWorld;
 }
 
-std::vector<glm::vec3> adjacentVertices(OpenMeshT &omMesh, OpenMeshT::VertexHandle vh) {
-  return omMesh.vv_range(vh).to_vector([&omMesh](const OpenMeshT::VertexHandle &vv) {
-    OpenMeshT::Point p = omMesh.point(vv);
-    return glm::vec3(p[0], p[1], p[2]);
-  });
+size_t getNextLabel() {
+  static size_t labelIdx = -1;
+  return ++labelIdx;
 }
 
-std::vector<float> computePerVertexMeanCurvature(broc::Mesh &brocMesh, OpenMeshT &omMesh) {
-  prof::watch w;
-  std::vector<float> rawCurvatures(omMesh.n_vertices());
-  for (OpenMeshT::VertexHandle vh : omMesh.vertices()) {
-    std::vector<glm::vec3> adjacent = adjacentVertices(omMesh, vh);
-    OpenMeshT::Point point = omMesh.point(vh);
-    OpenMeshT::Normal normal = omMesh.normal(vh);
-    glm::vec p = glm::vec3(point[0], point[1], point[2]);
-    glm::vec n = glm::vec3(normal[0], normal[1], normal[2]);
-    float meanCurvature = math::meanCurvature(p, adjacent, n);
-    float gaussianCurvature = math::gaussianCurvature(p, adjacent);
-    float k1 = meanCurvature + std::sqrt(meanCurvature * meanCurvature - gaussianCurvature);
-    float k2 = meanCurvature - std::sqrt(meanCurvature * meanCurvature - gaussianCurvature);
-    rawCurvatures[vh.idx()] = meanCurvature;
+// Mesh, curvatures, bvh and flow network for meshName, everything but GL; nullptr if cancelled.
+std::shared_ptr<Scene> loadScene(const std::string &meshName, jobs::token &tok) {
+  prof::watch meshesWatch;
+  std::shared_ptr<Scene> scene = std::make_shared<Scene>();
+  tok.progress(0.0f, "loading mesh");
+  {
+    cache::meshCache meshData = loadMeshCached(meshName);
+    scene->mesh = meshData.core();
+    // https://julie-jiang.github.io/image-segmentation/
+    std::span<const float> meanCurvatures = meshData.curvatureView(cache::meshCache::mean);
+    scene->rawCurvatures.assign(meanCurvatures.begin(), meanCurvatures.end());
   }
-  std::cout << w.report("curvature") << "\n";
-  return rawCurvatures;
+  if (tok.cancelled()) {
+    return nullptr;
+  }
+  tok.progress(0.5f, "percentiles");
+  scene->curvaturePercentiles.assign(scene->rawCurvatures);
+  tok.progress(0.6f, "bvh");
+  math::translateToOrigin(scene->mesh);
+  scene->brocMesh = convert(scene->mesh, meshName);
+  scene->bvh = bvhFromMesh(scene->mesh);
+  tok.progress(0.9f, "flow network");
+  scene->session = math::cutSession{flownetFromRing(scene->mesh.ring)};
+  std::cerr << meshesWatch.report("mesh loading") << "\n";
+  return scene;
 }
 
-std::vector<float> energyFromCurvatures(const std::vector<float> &rawCurvatures, float percentile) {
-  std::vector<float> energy = rawCurvatures;
-  auto [minCurvature, maxCurvature] = math::percentileThreshold(energy, percentile);
-
-  float infiniteWeight = 1e8 * energy.size();
-  float minQuality = curvatureToQuality(maxCurvature);
-  float maxQuality = curvatureToQuality(minCurvature);
-  for (size_t i = 0; i < energy.size(); ++i) {
-    float w = curvatureToQuality(energy[i]);
-    energy[i] = w;
+// A copy of from for a segmentation to write labels into, in the spare array when there is one.
+// The segmentation it is for supersedes the one in flight.
+std::vector<u8> takeLabelBack(Scene &scene, const std::vector<u8> &from) {
+  if (scene.segmentJob) {
+    scene.segmentJob->cancel();
   }
-  return energy;
+  std::vector<u8> labels = std::move(scene.labelBack);
+  labels.assign(from.begin(), from.end());
+  return labels;
 }
 
-std::vector<size_t> colorByBorders(broc::Mesh &brocMesh, OpenMeshT &omMesh, size_t sIdx,
-                                   size_t tIdx, const std::vector<float> &energy) {
-  size_t nVertices = brocMesh.vertices.size();
-  math::flownet g;
-  g.adj_.resize(nVertices);
-  g.capacity_.resize(nVertices);
-  for (OpenMeshT::VertexHandle vh : omMesh.vertices()) {
-    g.capacity_[vh.idx()].resize(nVertices);
-    for (OpenMeshT::HalfedgeHandle he : omMesh.voh_range(vh)) {
-      OpenMeshT::VertexHandle to = omMesh.to_vertex_handle(he);
-      g.adj_[vh.idx()].push_back(to.idx());
-      float infiniteWeight = 1e8 * omMesh.n_vertices();
-      float e1 = energy[vh.idx()];
-      float e2 = energy[to.idx()];
-      float diff = std::abs(e1 - e2);
-      float weight = (diff > math::EPS) ? (1.0 / diff) : std::numeric_limits<i32>::max();
-      if (std::abs(e1) > 100 || std::abs(e2) > 100) {
-        weight = 0.0f;
-      }
-      g.capacity_[vh.idx()][to.idx()] = static_cast<i32>(weight);
+// from a job: the frame loop swaps labels in and keeps the array it replaces as the spare
+void postLabels(Scene &scene, jobs::worker &worker, jobs::token &tok, std::vector<u8> labels) {
+  std::shared_ptr<std::vector<u8>> result = std::make_shared<std::vector<u8>>(std::move(labels));
+  worker.post(tok, [&scene, result] {
+    scene.brocMesh.swapLabels(*result);
+    scene.brocMesh.sendLabels();
+    scene.labelBack = std::move(*result);
+    // every label was replaced, the brush segment included
+    if (!scene.brushBase.empty()) {
+      scene.brushBase = scene.brocMesh.labels;
+      scene.brushPainted.clear();
     }
-  }
-  std::vector<size_t> result = g.mincut(sIdx, tIdx);
+  });
+}
 
-  {
-    std::unordered_set<size_t> setResult(result.begin(), result.end());
-    for (OpenMeshT::VertexHandle vh : omMesh.vertices()) {
-      bool allNeighborsSelected = true;
-      for (OpenMeshT::VertexHandle vv : omMesh.vv_range(vh)) {
-        if (setResult.find(vv.idx()) == setResult.end()) {
-          allNeighborsSelected = false;
-        }
+// from a job: the source side of a cut gets code on top of the labels on screen, so cuts still
+// in flight land as well. A re-cut of the current brush segment first puts back what was under
+// the segment; any other cut is written under it too.
+void postCut(Scene &scene, jobs::worker &worker, jobs::token &tok, std::vector<u32> cut, u8 code,
+             std::optional<u32> segment) {
+  std::shared_ptr<std::vector<u32>> result = std::make_shared<std::vector<u32>>(std::move(cut));
+  worker.post(tok, [&scene, result, code, segment] {
+    broc::Mesh &brocMesh = scene.brocMesh;
+    const bool recut = segment == scene.brushSegment && !scene.brushBase.empty();
+    if (recut) {
+      for (u32 v : scene.brushPainted) {
+        brocMesh.setLabelCode(v, scene.brushBase[v]);
       }
-      if (allNeighborsSelected && setResult.find(vh.idx()) == setResult.end()) {
-        result.push_back(vh.idx());
+    }
+    for (u32 v : *result) {
+      brocMesh.setLabelCode(v, code);
+      if (!recut && !scene.brushBase.empty()) {
+        scene.brushBase[v] = code;
       }
     }
-  }
-
-  return result;
-}
-
-void translateToOrigin(broc::Mesh &brocMesh) {
-  math::BBox box;
-  for (const auto &v : brocMesh.vertices) {
-    box.addPoint(v.pos);
-  }
-  glm::vec3 translate = -1.0f * (box.maxp + box.minp) / 2.0f;
-  glm::vec3 diag = box.maxp - box.minp;
-  float scale = std::max(diag[0], std::max(diag[1], diag[2]));
-  glm::mat4 normalizer = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / scale)) *
-                         glm::translate(glm::mat4(1.0f), translate);
-  for (auto &v : brocMesh.vertices) {
-    v.pos = glm::vec3(normalizer * glm::vec4(v.pos, 1.0f));
-  }
-}
-
-broc::Mesh convert(const OpenMeshT &omMesh, const std::string &name) {
-  broc::Mesh brocMesh{name};
-  for (OpenMeshT::VertexIter vIt = omMesh.vertices_begin(); vIt != omMesh.vertices_end(); ++vIt) {
-    OpenMeshT::Point p = omMesh.point(*vIt);
-    OpenMeshT::Normal n = omMesh.normal(*vIt);
-    broc::Mesh::Vertex v{.pos = glm::vec3(p[0], p[1], p[2]),
-                         .normal = glm::vec3(n[0], n[1], n[2]),
-                         .color = glm::vec3(0.3f, 0.3f, 0.3f)};
-    brocMesh.vertices.push_back(v);
-  }
-
-  for (OpenMeshT::ConstFaceIter fIt = omMesh.faces_begin(); fIt != omMesh.faces_end(); ++fIt) {
-    OpenMeshT::Face f = omMesh.face(*fIt);
-    for (OpenMeshT::ConstFaceVertexIter fvIt = omMesh.cfv_iter(*fIt); fvIt.is_valid(); ++fvIt) {
-      brocMesh.indices.push_back(fvIt->idx());
+    if (recut) {
+      scene.brushPainted = std::move(*result);
     }
-  }
-  return brocMesh;
+    brocMesh.sendLabels();
+  });
 }
 
-OpenMeshT loadMesh(const std::string &pFile) {
-  OpenMeshT mesh;
-  mesh.request_vertex_normals();
-  mesh.request_edge_colors();
-  if (!mesh.has_vertex_normals()) {
-    std::cout << "normals not available\n";
-  }
-  OpenMesh::IO::Options opt;
-  if (!OpenMesh::IO::read_mesh(mesh, pFile.c_str(), opt)) {
-    std::cout << "openmesh read error\n";
-    exit(-1);
+void segmentLabels(Scene &scene, jobs::worker &worker) {
+  // labels without seeds are left out of the expansion
+  std::vector<std::vector<u32>> seeds;
+  std::vector<size_t> labelIds;
+  for (size_t label = 0; label < scene.labelSeeds.size(); ++label) {
+    if (!scene.labelSeeds[label].empty()) {
+      seeds.push_back(scene.labelSeeds[label]);
+      labelIds.push_back(label);
+    }
   }
-  if (!opt.check(OpenMesh::IO::Options::VertexNormal)) {
-    mesh.request_face_normals();
-    mesh.update_normals();
-    mesh.release_face_normals();
+  if (seeds.size() < 2) {
+    std::cerr << "multi-label segmentation needs seeds for at least two labels\n";
+    return;
   }
-  std::cout << "## n vertices: " << mesh.n_vertices() << "\n";
-  std::cout << "## n faces: " << mesh.n_faces() << "\n";
-
-  return mesh;
-}
-
-glm::vec3 mouseToWorldDir(const glm::ivec2 &mouse, const broc::Camera &camera) {
-  float x = (2.0f * mouse.x) / camera.screenWidth - 1.0f;
-  float y = 1.0f - (2.0f * mouse.y) / camera.screenHeight;
-  float z = 1.0f;
-  glm::vec4 rayClip = glm::vec4(x, y, -1.0, 1.0);
-  glm::vec4 rayEye = glm::inverse(camera.projM) * rayClip;
-  rayEye.w = 0.0;
-
-  glm::vec4 tmp = glm::inverse(camera.viewM) * rayEye;
-  glm::vec3 rayWorld = glm::vec3(tmp.x, tmp.y, tmp.z);
-  rayWorld = glm::normalize(rayWorld);
-  return rayWorld;
+  float percentile = scene.percentile;
+  bool randomWalk = scene.randomWalk;
+  scene.segmentJob = worker.submit([&scene, &worker, seeds, labelIds, percentile, randomWalk,
+                                    labels = takeLabelBack(scene, scene.brocMesh.labels)](
+                                       jobs::token &tok) mutable {
+    tok.progress(0.0f, "energy");
+    std::vector<float> energy =
+        energyFromCurvatures(scene.rawCurvatures, scene.curvaturePercentiles, percentile);
+    auto stop = [&tok] { return tok.cancelled(); };
+    std::vector<u32> result;
+    if (randomWalk) {
+      if (scene.walker.empty()) {
+        tok.progress(0.1f, "cotangent weights");
+        scene.walker = math::randomWalker{scene.mesh};
+      }
+      if (scene.walkerPercentile != percentile) {
+        scene.walker.setEnergy(scene.mesh.ring, energy);
+        scene.walkerPercentile = percentile;
+      }
+      tok.progress(0.2f, "random walker");
+      result = segmentRandomWalker(scene.walker, scene.mesh.ring, seeds, stop);
+    } else {
+      tok.progress(0.2f, "alpha-expansion");
+      scene.session.invalidate();
+      result = segmentMultiLabel(scene.session.graph(), energy, seeds, stop);
+    }
+    if (tok.cancelled()) {
+      return;
+    }
+    for (size_t vIdx = 0; vIdx < result.size(); ++vIdx) {
+      labels[vIdx] = broc::Mesh::labelCode(labelIds[result[vIdx]]);
+    }
+    tok.progress(1.0f, "done");
+    postLabels(scene, worker, tok, std::move(labels));
+  });
+  scene.labelJob = scene.segmentJob;
 }
 
-glm::vec3 getNextColor() {
-  static size_t colorIdx = -1;
-  ++colorIdx;
-  std::vector<float> hue = {0.0f,  180.0f, 270.0f, 45.0f, 225.0f, 315.0f,
-                            15.0f, 195.0f, 285.0f, 30.0f, 210.0f, 300.0f};
-  std::vector<glm::vec3> colors;
-  colors.reserve(hue.size());
-  auto rgbFromHue = [](const float& h) {
-    return math::rgbFromHsv(h / 360.0f, 1.0f, 1.0f);
-  };
-  std::transform(hue.begin(), hue.end(), std::back_inserter(colors), rgbFromHue);
-  if (colorIdx >= colors.size()) {
-    colorIdx = 0;
-  }
-  return colors.at(colorIdx);
+// The cut between two seed sets, computed on the worker: the source side gets selectionLabel.
+// segment is the brush segment it re-cuts, if any.
+std::shared_ptr<jobs::token> cutSeeds(Scene &scene, jobs::worker &worker,
+                                      std::vector<u32> sources, std::vector<u32> sinks,
+                                      size_t selectionLabel, std::optional<u32> segment) {
+  float percentile = scene.percentile;
+  math::maxflow algorithm = scene.maxflow;
+  bool coarseToFine = scene.coarseToFine;
+  region::cleanupOptions cleanup = scene.cleanup;
+  scene.labelJob = worker.submit([&scene, &worker, sources = std::move(sources),
+                                  sinks = std::move(sinks), selectionLabel, segment, percentile,
+                                  algorithm, coarseToFine, cleanup](jobs::token &tok) {
+    tok.progress(0.0f, "energy");
+    const bool pyramidReady = coarseToFine && scene.pyramidPercentile == percentile;
+    std::vector<float> energy;
+    if (!pyramidReady) {
+      energy = energyFromCurvatures(scene.rawCurvatures, scene.curvaturePercentiles, percentile);
+    }
+    if (tok.cancelled()) {
+      return;
+    }
+    std::vector<u32> cut;
+    auto label = [&](const auto &result) { cut.assign(result.begin(), result.end()); };
+    if (coarseToFine) {
+      if (!pyramidReady) {
+        tok.progress(0.1f, "pyramid");
+        scene.pyramid = math::multiscaleCut{scene.mesh.ring, scene.mesh.positions,
+                                            cutCapacities(scene.session.graph(), energy)};
+        scene.pyramidPercentile = percentile;
+      }
+      tok.progress(0.5f, "coarse to fine cut");
+      mem::arena &scratch = scene.session.scratch();
+      scratch.reset();
+      label(colorByBorders(scene.pyramid, scene.mesh.ring, sources, sinks, scratch, cleanup));
+    } else if (algorithm == math::maxflow::boykovKolmogorov || sources.size() > 1 ||
+               sinks.size() > 1) {
+      // the other solvers take one source and one sink
+      tok.progress(0.2f, "min cut");
+      label(colorByBorders(scene.session, scene.mesh.ring, sources, sinks, energy, cleanup));
+    } else {
+      tok.progress(0.2f, "min cut");
+      scene.session.invalidate();
+      label(colorByBorders(scene.session.graph(), scene.mesh.ring, sources[0], sinks[0], energy,
+                           algorithm, cleanup));
+    }
+    tok.progress(1.0f, "done");
+    postCut(scene, worker, tok, std::move(cut), broc::Mesh::labelCode(selectionLabel), segment);
+  });
+  return scene.labelJob;
 }
 
 void handleMouseClickLeft(const glm::ivec2 &mouse, const broc::Camera &camera, Scene &scene,
-                          const std::vector<float> &rawCurvatures) {
+                          jobs::worker &worker) {
   glm::vec3 rayWorld = mouseToWorldDir(mouse, camera);
 
   broc::Mesh &brocMesh = scene.brocMesh;
-  OpenMeshT &omMesh = scene.omMesh;
-  std::vector<float> vertexDistances(brocMesh.vertices.size(), std::numeric_limits<float>::max());
-  bool found = false;
-  for (size_t i = 0; i < brocMesh.vertices.size(); ++i) {
-    float dist = glm::length(glm::cross(rayWorld, brocMesh.vertices[i].pos - camera.cameraPos));
-    if (dist <= 0.01) {
-      float d = glm::dot(rayWorld, brocMesh.vertices[i].pos - camera.cameraPos);
-      vertexDistances[i] = d;
-      found = true;
-    }
-  }
-  size_t minDistIdx = std::distance(
-      vertexDistances.begin(), std::min_element(vertexDistances.begin(), vertexDistances.end()));
-  if (!found) {
+  std::optional<math::rayHit> hit = scene.bvh.intersect(camera.cameraPos, rayWorld);
+  if (!hit) {
     scene.selectedVertexIndices.clear();
-    colorBy(scene.brocMesh, rawCurvatures, scene.percentile);
-    brocMesh.sendGl();
+    colorBy(scene.brocMesh, scene.curvaturePercentiles, scene.percentile);
     return;
   }
+  size_t minDistIdx = brocMesh.indices[3 * hit->face + hit->corner];
 
-  //brocMesh.vertices[minDistIdx].color = glm::vec3(0.5, 0.0, 0.5);
+  if (scene.multiLabel) {
+    size_t label = static_cast<size_t>(scene.currentLabel);
+    if (scene.labelSeeds.size() <= label) {
+      scene.labelSeeds.resize(label + 1);
+    }
+    scene.labelSeeds[label].push_back(static_cast<u32>(minDistIdx));
+    // the labels a running segmentation started from are stale now
+    if (scene.segmentJob) {
+      scene.segmentJob->cancel();
+    }
+    brocMesh.setLabel(minDistIdx, label);
+    brocMesh.sendLabels();
+    return;
+  }
+
+  //brocMesh.setLabel(minDistIdx, 0);
   scene.selectedVertexIndices.push_back(minDistIdx);
   if (scene.selectedVertexIndices.size() >= 2) {
     size_t sIdx = scene.selectedVertexIndices[0];
     size_t tIdx = scene.selectedVertexIndices[1];
     scene.selectedVertexIndices.clear();
-    std::vector<float> energy = energyFromCurvatures(rawCurvatures, scene.percentile);
-    std::vector<size_t> result = colorByBorders(brocMesh, omMesh, sIdx, tIdx, energy);
-    glm::vec3 selectionColor = getNextColor();
-    for (size_t vIdx : result) {
-      scene.brocMesh.vertices[vIdx].color = selectionColor;
+    // an unrelated cut, one still in flight keeps going
+    cutSeeds(scene, worker, {static_cast<u32>(sIdx)}, {static_cast<u32>(tIdx)}, getNextLabel(),
+             std::nullopt);
+  }
+}
+
+// center and the vertices up to rings edges away from it
+std::vector<u32> brushDab(const math::OneRing &ring, u32 center, u32 rings) {
+  std::vector<u32> dab(1, center);
+  size_t ringBeg = 0;
+  for (u32 r = 0; r < rings; ++r) {
+    size_t ringEnd = dab.size();
+    for (size_t i = ringBeg; i < ringEnd; ++i) {
+      for (u32 j = ring.offsets[dab[i]]; j < ring.offsets[dab[i] + 1]; ++j) {
+        u32 w = ring.vertices[j];
+        if (std::find(dab.begin(), dab.end(), w) == dab.end()) {
+          dab.push_back(w);
+        }
+      }
+    }
+    ringBeg = ringEnd;
+  }
+  return dab;
+}
+
+// while the button is down: the dab under the mouse joins the stroke, sources show right away
+void brushStroke(const glm::ivec2 &mouse, const broc::Camera &camera, Scene &scene, bool sink) {
+  std::optional<math::rayHit> hit =
+      scene.bvh.intersect(camera.cameraPos, mouseToWorldDir(mouse, camera));
+  if (!hit) {
+    return;
+  }
+  broc::Mesh &brocMesh = scene.brocMesh;
+  if (scene.stroke.empty()) {
+    // a running segmentation started from labels without this stroke, and the segment's own
+    // re-cut is superseded by the one this stroke ends in
+    for (const std::shared_ptr<jobs::token> &job : {scene.segmentJob, scene.brushJob}) {
+      if (job) {
+        job->cancel();
+      }
+    }
+    scene.strokeIsSink = sink;
+    if (!scene.brushLabel) {
+      scene.brushLabel = getNextLabel();
+      scene.brushBase = brocMesh.labels;
+    }
+  }
+  u32 center = brocMesh.indices[3 * hit->face + hit->corner];
+  for (u32 v : brushDab(scene.mesh.ring, center, static_cast<u32>(scene.brushRings))) {
+    scene.stroke.push_back(v);
+    if (!scene.strokeIsSink) {
+      brocMesh.setLabel(v, *scene.brushLabel);
+      scene.brushPainted.push_back(v);
     }
-    brocMesh.sendGl();
   }
+  brocMesh.sendLabels();
+}
+
+// on release: the stroke joins the seeds and, once both kinds are there, the segment is re-cut
+// through the same session, so the network is not rebuilt
+void finishStroke(Scene &scene, jobs::worker &worker) {
+  std::vector<u32> &seeds = scene.strokeIsSink ? scene.brushSinks : scene.brushSources;
+  seeds.insert(seeds.end(), scene.stroke.begin(), scene.stroke.end());
+  std::sort(seeds.begin(), seeds.end());
+  seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+  scene.stroke.clear();
+  if (scene.brushSources.empty() || scene.brushSinks.empty()) {
+    return;
+  }
+  if (scene.brushJob) {
+    scene.brushJob->cancel();
+  }
+  scene.brushJob = cutSeeds(scene, worker, scene.brushSources, scene.brushSinks,
+                            *scene.brushLabel, scene.brushSegment);
+}
+
+// stage and progress of a job while it runs, with a button to cancel it
+void jobStatus(const char *name, const std::shared_ptr<jobs::token> &job) {
+  if (!job || job->done()) {
+    return;
+  }
+  ImGui::PushID(name);
+  ImGui::Text("%s: %s", name, job->stage());
+  ImGui::ProgressBar(job->progress());
+  ImGui::SameLine();
+  if (ImGui::Button("cancel")) {
+    job->cancel();
+  }
+  ImGui::PopID();
 }
 
 } // namespace brocseg
@@ -283,20 +433,31 @@ int main(int argc, char *argv[]) {
   int screenHeight = 1000;
   broc::OpenGLRenderer renderer{"brocseg", screenWidth, screenHeight};
 
-  prof::watch meshesWatch;
   const char *meshName = "stl/leg.stl";
   //const char *meshName = "stl/bunny.obj";
 
-  Scene scene = {.omMesh = loadMesh(meshName),
-                 .brocMesh = convert(scene.omMesh, meshName),
-                 .percentile = 0.9f};
-  translateToOrigin(scene.brocMesh);
-  std::cout << meshesWatch.report("mesh loading") << "\n";
-  scene.brocMesh.sendGl();
-
-  // https://julie-jiang.github.io/image-segmentation/
-  std::vector<float> rawCurvatures = computePerVertexMeanCurvature(scene.brocMesh, scene.omMesh);
-  colorBy(scene.brocMesh, rawCurvatures, scene.percentile);
+  // the worker is declared after the scene, so it is joined before the scene is destroyed
+  Scene scene;
+  jobs::worker worker;
+  std::shared_ptr<jobs::token> loading = worker.submit([&scene, &worker,
+                                                         meshName](jobs::token &tok) {
+    std::shared_ptr<Scene> loaded = loadScene(meshName, tok);
+    if (!loaded) {
+      return;
+    }
+    worker.post(tok, [&scene, loaded] {
+      scene.mesh = std::move(loaded->mesh);
+      scene.brocMesh = std::move(loaded->brocMesh);
+      scene.bvh = std::move(loaded->bvh);
+      scene.session = std::move(loaded->session);
+      scene.rawCurvatures = std::move(loaded->rawCurvatures);
+      scene.curvaturePercentiles = std::move(loaded->curvaturePercentiles);
+      scene.brocMesh.sendGl();
+      scene.brocMesh.setField(scene.rawCurvatures);
+      colorBy(scene.brocMesh, scene.curvaturePercentiles, scene.percentile);
+      scene.loaded = true;
+    });
+  });
 
   const char *vertex_shader =
 #include "shader.vs"
@@ -318,13 +479,18 @@ int main(int argc, char *argv[]) {
   bool running = true;
   size_t replayIdx = 0;
   std::vector<size_t> replay;
+  broc::ProfilerOverlay profiler;
+  bool showProfiler = false;
   while (running) {
+    BROC_FRAME();
     ImGuiIO &io = ImGui::GetIO();
     running = renderer.begFrame();
+    worker.runPosted();
 
     ImGui::ShowDemoWindow();
 
-    if (!io.WantCaptureMouse) {
+    if (!io.WantCaptureMouse && scene.loaded) {
+      BROC_ZONE("input");
       if (ImGui::IsMouseDown(ImGuiMouseButton_Right)) {
         if (io.MouseDelta.x != 0 || io.MouseDelta.y != 0) {
           float dPhi = ((float)(-io.MouseDelta.y) / 300.0f);
@@ -340,16 +506,87 @@ int main(int argc, char *argv[]) {
         camera.updateMatrices();
       }
 
-      if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
-        glm::ivec2 mouse = glm::ivec2(io.MousePos.x, io.MousePos.y);
-        handleMouseClickLeft(mouse, camera, scene, rawCurvatures);
+      glm::ivec2 mouse = glm::ivec2(io.MousePos.x, io.MousePos.y);
+      if (scene.brush) {
+        if (ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+          brushStroke(mouse, camera, scene, io.KeyCtrl);
+        }
+      } else if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+        handleMouseClickLeft(mouse, camera, scene, worker);
       }
     }
+    // even when released over a window
+    if (ImGui::IsMouseReleased(ImGuiMouseButton_Left) && !scene.stroke.empty()) {
+      finishStroke(scene, worker);
+    }
 
-    if (ImGui::SliderFloat("curvature percentile", &scene.percentile, 0.1f, 1.0f)) {
-      colorBy(scene.brocMesh, rawCurvatures, scene.percentile);
+    // the percentiles are empty until the load lands, it colours by the value set here
+    if (ImGui::SliderFloat("curvature percentile", &scene.percentile, 0.1f, 1.0f) &&
+        scene.loaded) {
+      colorBy(scene.brocMesh, scene.curvaturePercentiles, scene.percentile, true);
+    }
+    if (ImGui::IsItemDeactivatedAfterEdit() && scene.loaded) {
+      colorBy(scene.brocMesh, scene.curvaturePercentiles, scene.percentile);
+    }
+
+    const char *maxflowNames[] = {math::maxflowName(math::maxflow::edmondsKarp),
+                                  math::maxflowName(math::maxflow::pushRelabel),
+                                  math::maxflowName(math::maxflow::boykovKolmogorov),
+                                  math::maxflowName(math::maxflow::capacityScaling)};
+    int maxflowIdx = static_cast<int>(scene.maxflow);
+    if (ImGui::Combo("max-flow", &maxflowIdx, maxflowNames, IM_ARRAYSIZE(maxflowNames))) {
+      scene.maxflow = static_cast<math::maxflow>(maxflowIdx);
+    }
+    // boykov-kolmogorov on a band around the boundary, whatever the max-flow above
+    ImGui::Checkbox("coarse to fine", &scene.coarseToFine);
+    // applied to the next cut
+    int closeIterations = static_cast<int>(scene.cleanup.closeIterations);
+    if (ImGui::SliderInt("closing rings", &closeIterations, 0, 8)) {
+      scene.cleanup.closeIterations = static_cast<u32>(closeIterations);
+    }
+    int minComponent = static_cast<int>(scene.cleanup.minComponent);
+    if (ImGui::SliderInt("min island", &minComponent, 1, 4096)) {
+      scene.cleanup.minComponent = static_cast<u32>(minComponent);
+    }
+
+    ImGui::Checkbox("profiler", &showProfiler);
+    if (showProfiler) {
+      profiler.draw(&showProfiler);
+    }
+
+    ImGui::Checkbox("brush", &scene.brush);
+    if (scene.brush) {
+      ImGui::SliderInt("brush rings", &scene.brushRings, 0, 8);
+      ImGui::Text("sources: %zu, sinks (ctrl): %zu", scene.brushSources.size(),
+                  scene.brushSinks.size());
+      if (ImGui::Button("new segment")) {
+        // the last re-cut of the old segment still lands, as a cut of its own
+        scene.brushSources.clear();
+        scene.brushSinks.clear();
+        scene.brushLabel.reset();
+        scene.brushBase.clear();
+        scene.brushPainted.clear();
+        scene.brushJob.reset();
+        ++scene.brushSegment;
+      }
+    }
+
+    ImGui::Checkbox("multi-label", &scene.multiLabel);
+    if (scene.multiLabel) {
+      ImGui::SliderInt("seed label", &scene.currentLabel, 0, 11);
+      ImGui::Checkbox("random walker", &scene.randomWalk);
+      if (ImGui::Button("segment") && scene.loaded) {
+        segmentLabels(scene, worker);
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("clear seeds")) {
+        scene.labelSeeds.clear();
+      }
     }
 
+    jobStatus("loading", loading);
+    jobStatus("labels", scene.labelJob);
+
     for (size_t vIdx : scene.selectedVertexIndices) {
       ImGui::Text("sIdx: %llu", vIdx);
     }
@@ -365,9 +602,14 @@ int main(int argc, char *argv[]) {
     shader.uniformMatrix4fv("view", camera.viewM);
     shader.uniformMatrix4fv("projection", camera.projM);
     shader.uniform3fv("lightPos", lightPos);
+    scene.brocMesh.setUniforms(shader);
 
-    scene.brocMesh.draw();
+    if (scene.loaded) {
+      BROC_ZONE("draw");
+      scene.brocMesh.draw();
+    }
 
+    BROC_ZONE("endFrame");
     renderer.endFrame();
   }
   return 0;
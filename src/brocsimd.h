@@ -0,0 +1,247 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "broccommon.h"
+#include "brocmath.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BROC_SIMD_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// msvc accepts avx2 intrinsics in any function, the cpu check below guards the call
+#define BROC_TARGET_AVX2
+#else
+#define BROC_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#else
+#define BROC_SIMD_AVX2 0
+#endif
+
+namespace brocseg {
+namespace math {
+
+// Per-face values every corner needs for curvature, stored as structure of arrays.
+// Corner k of face f is the vertex indices[3 * f + k].
+struct FaceGeometry {
+  std::vector<float> area;
+  std::vector<float> cot[3];   // cotangent of the angle at corner k
+  std::vector<float> angle[3]; // angle at corner k
+  std::vector<float> mixed[3]; // mixed Voronoi area corner k adds to its vertex
+
+  void resize(size_t nFaces) {
+    area.resize(nFaces);
+    for (int k = 0; k < 3; ++k) {
+      cot[k].resize(nFaces);
+      angle[k].resize(nFaces);
+      mixed[k].resize(nFaces);
+    }
+  }
+};
+
+namespace simd {
+
+inline float clampCotan(float c) {
+  const float cotan_max = std::cos(EPS) / std::sin(EPS);
+  return std::isnan(c) ? 0.0f : std::clamp(c, -cotan_max, cotan_max);
+}
+
+// scalar reference for faces [beg, end), same math as the 8-wide kernel
+inline void faceGeometryScalar(const glm::vec3 *positions, const u32 *indices, size_t beg,
+                               size_t end, FaceGeometry &out) {
+  for (size_t f = beg; f < end; ++f) {
+    const glm::vec3 &a = positions[indices[3 * f + 0]];
+    const glm::vec3 &b = positions[indices[3 * f + 1]];
+    const glm::vec3 &c = positions[indices[3 * f + 2]];
+    const glm::vec3 ab = b - a;
+    const glm::vec3 ac = c - a;
+    const glm::vec3 bc = c - b;
+    // |u x v| is twice the area for every corner, so one cross product serves all three
+    const float crossLen = glm::length(glm::cross(ab, ac));
+    const float dots[3] = {glm::dot(ab, ac), -glm::dot(ab, bc), glm::dot(ac, bc)};
+    const float len2s[3] = {len2(bc), len2(ac), len2(ab)}; // squared length opposite corner k
+    const float area = 0.5f * crossLen;
+    const bool obtuse = dots[0] < 0.0f || dots[1] < 0.0f || dots[2] < 0.0f;
+    float cots[3];
+    for (int k = 0; k < 3; ++k) {
+      cots[k] = clampCotan(dots[k] / crossLen);
+      out.cot[k][f] = cots[k];
+      out.angle[k][f] = std::atan2(crossLen, dots[k]);
+    }
+    out.area[f] = area;
+    for (int k = 0; k < 3; ++k) {
+      int k1 = (k + 1) % 3;
+      int k2 = (k + 2) % 3;
+      float voronoi = (1.0f / 8.0f) * (len2s[k2] * cots[k2] + len2s[k1] * cots[k1]);
+      out.mixed[k][f] = !obtuse ? voronoi : (dots[k] < 0.0f ? 0.5f * area : 0.25f * area);
+    }
+  }
+}
+
+#if BROC_SIMD_AVX2
+struct vec3x8 {
+  __m256 x, y, z;
+};
+
+BROC_TARGET_AVX2 inline vec3x8 sub8(const vec3x8 &a, const vec3x8 &b) {
+  return {_mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z)};
+}
+
+BROC_TARGET_AVX2 inline __m256 dot8(const vec3x8 &a, const vec3x8 &b) {
+  return _mm256_fmadd_ps(a.x, b.x, _mm256_fmadd_ps(a.y, b.y, _mm256_mul_ps(a.z, b.z)));
+}
+
+BROC_TARGET_AVX2 inline vec3x8 cross8(const vec3x8 &a, const vec3x8 &b) {
+  return {_mm256_fmsub_ps(a.y, b.z, _mm256_mul_ps(a.z, b.y)),
+          _mm256_fmsub_ps(a.z, b.x, _mm256_mul_ps(a.x, b.z)),
+          _mm256_fmsub_ps(a.x, b.y, _mm256_mul_ps(a.y, b.x))};
+}
+
+BROC_TARGET_AVX2 inline __m256 length8(const vec3x8 &a) { return _mm256_sqrt_ps(dot8(a, a)); }
+
+// dot(u, v) / |u x v| with the clamping of laplacianCotanWeight (nan -> 0); the nan mask is
+// taken before the clamp, max_ps(nan, x) returns x
+BROC_TARGET_AVX2 inline __m256 cotan8(__m256 dot, __m256 crossLen) {
+  const __m256 cotanMax = _mm256_set1_ps(std::cos(EPS) / std::sin(EPS));
+  __m256 c = _mm256_div_ps(dot, crossLen);
+  __m256 ordered = _mm256_cmp_ps(c, c, _CMP_ORD_Q);
+  c = _mm256_min_ps(_mm256_max_ps(c, _mm256_sub_ps(_mm256_setzero_ps(), cotanMax)), cotanMax);
+  return _mm256_and_ps(c, ordered);
+}
+
+// angle between u and v as atan2(|u x v|, u . v), no acos and no normalisation;
+// minimax polynomial for atan on [0, 1], max error around 1e-7 rad
+BROC_TARGET_AVX2 inline __m256 angleBetweenVectors8(__m256 dot, __m256 crossLen) {
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 ax = _mm256_and_ps(dot, absMask);
+  __m256 hi = _mm256_max_ps(ax, crossLen);
+  __m256 lo = _mm256_min_ps(ax, crossLen);
+  __m256 t = _mm256_div_ps(lo, _mm256_max_ps(hi, _mm256_set1_ps(1e-30f)));
+  __m256 s = _mm256_mul_ps(t, t);
+  __m256 p = _mm256_set1_ps(-0.0040540580f);
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.0218612288f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.0559098861f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.0964200441f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.1390853351f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.1994653599f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.3332985605f));
+  p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.9999993329f));
+  __m256 r = _mm256_mul_ps(p, t);
+  __m256 steep = _mm256_cmp_ps(crossLen, ax, _CMP_GT_OQ);
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(halfpi), r), steep);
+  // blend on the sign bit of dot, as atan2 does, so a -0 dot gives pi
+  return _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(pi), r), dot);
+}
+
+// voronoiRegion for 8 triangles given the two far cotangents and squared edge lengths
+BROC_TARGET_AVX2 inline __m256 voronoiRegion8(__m256 len2pr, __m256 cotq, __m256 len2pq,
+                                              __m256 cotr) {
+  return _mm256_mul_ps(_mm256_set1_ps(1.0f / 8.0f),
+                       _mm256_fmadd_ps(len2pr, cotq, _mm256_mul_ps(len2pq, cotr)));
+}
+
+BROC_TARGET_AVX2 inline vec3x8 gather8(const float *positions, __m256i vertex) {
+  __m256i base = _mm256_mullo_epi32(vertex, _mm256_set1_epi32(3));
+  return {_mm256_i32gather_ps(positions, base, 4),
+          _mm256_i32gather_ps(positions, _mm256_add_epi32(base, _mm256_set1_epi32(1)), 4),
+          _mm256_i32gather_ps(positions, _mm256_add_epi32(base, _mm256_set1_epi32(2)), 4)};
+}
+
+// faces [beg, end) eight at a time, the remainder goes through the scalar path
+BROC_TARGET_AVX2 inline void faceGeometryAvx2(const glm::vec3 *positions, const u32 *indices,
+                                              size_t beg, size_t end, FaceGeometry &out) {
+  static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "positions must be packed floats");
+  const float *p = &positions[0].x;
+  const int *idx = reinterpret_cast<const int *>(indices);
+  const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256 zero = _mm256_setzero_ps();
+  size_t f = beg;
+  for (; f + 8 <= end; f += 8) {
+    const int *faceIdx = idx + 3 * f;
+    vec3x8 a = gather8(p, _mm256_i32gather_epi32(faceIdx, stride, 4));
+    vec3x8 b = gather8(p, _mm256_i32gather_epi32(faceIdx + 1, stride, 4));
+    vec3x8 c = gather8(p, _mm256_i32gather_epi32(faceIdx + 2, stride, 4));
+    vec3x8 ab = sub8(b, a);
+    vec3x8 ac = sub8(c, a);
+    vec3x8 bc = sub8(c, b);
+    __m256 crossLen = length8(cross8(ab, ac));
+    // negated by flipping the sign bit, 0 - x would turn the -0 of the scalar path into +0
+    __m256 dots[3] = {dot8(ab, ac), _mm256_xor_ps(_mm256_set1_ps(-0.0f), dot8(ab, bc)),
+                      dot8(ac, bc)};
+    __m256 len2s[3] = {dot8(bc, bc), dot8(ac, ac), dot8(ab, ab)};
+    __m256 area = _mm256_mul_ps(_mm256_set1_ps(0.5f), crossLen);
+    __m256 obtuse = _mm256_or_ps(_mm256_cmp_ps(dots[0], zero, _CMP_LT_OQ),
+                                 _mm256_or_ps(_mm256_cmp_ps(dots[1], zero, _CMP_LT_OQ),
+                                              _mm256_cmp_ps(dots[2], zero, _CMP_LT_OQ)));
+    __m256 cots[3];
+    for (int k = 0; k < 3; ++k) {
+      cots[k] = cotan8(dots[k], crossLen);
+      _mm256_storeu_ps(&out.cot[k][f], cots[k]);
+      _mm256_storeu_ps(&out.angle[k][f], angleBetweenVectors8(dots[k], crossLen));
+    }
+    _mm256_storeu_ps(&out.area[f], area);
+    __m256 half = _mm256_mul_ps(_mm256_set1_ps(0.5f), area);
+    __m256 quarter = _mm256_mul_ps(_mm256_set1_ps(0.25f), area);
+    for (int k = 0; k < 3; ++k) {
+      int k1 = (k + 1) % 3;
+      int k2 = (k + 2) % 3;
+      __m256 voronoi = voronoiRegion8(len2s[k2], cots[k2], len2s[k1], cots[k1]);
+      __m256 obtuseArea =
+          _mm256_blendv_ps(quarter, half, _mm256_cmp_ps(dots[k], zero, _CMP_LT_OQ));
+      _mm256_storeu_ps(&out.mixed[k][f], _mm256_blendv_ps(voronoi, obtuseArea, obtuse));
+    }
+  }
+  faceGeometryScalar(positions, indices, f, end, out);
+}
+
+inline bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool fma = (info[2] & (1 << 12)) != 0;
+  if (!osxsave || !fma || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+using faceGeometryKernel = void (*)(const glm::vec3 *, const u32 *, size_t, size_t,
+                                    FaceGeometry &);
+
+// picked once per process from what the cpu supports
+inline faceGeometryKernel selectFaceGeometryKernel() {
+#if BROC_SIMD_AVX2
+  static const faceGeometryKernel kernel = cpuHasAvx2() ? faceGeometryAvx2 : faceGeometryScalar;
+  return kernel;
+#else
+  return faceGeometryScalar;
+#endif
+}
+
+} // namespace simd
+
+inline FaceGeometry computeFaceGeometry(const std::vector<glm::vec3> &positions,
+                                        const std::vector<u32> &indices) {
+  size_t nFaces = indices.size() / 3;
+  FaceGeometry result;
+  result.resize(nFaces);
+  simd::faceGeometryKernel kernel = simd::selectFaceGeometryKernel();
+  par::forChunks(nFaces, [&](size_t beg, size_t end) {
+    BROC_ZONE("faceGeometry");
+    kernel(positions.data(), indices.data(), beg, end, result);
+  });
+  return result;
+}
+
+} // namespace math
+} // namespace brocseg
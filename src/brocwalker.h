@@ -0,0 +1,567 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "broccommon.h"
+#include "broccore.h"
+#include "brocparallel.h"
+#include "brocprof.h"
+#include "brocsimd.h"
+
+namespace brocseg {
+namespace math {
+
+// Cotangent weight of every ring entry: cot alpha + cot beta of the two angles facing the edge,
+// clamped as in laplacianCotanWeight, from the per-face cotangents of the curvature pass.
+inline std::vector<float> cotanWeights(const std::vector<glm::vec3> &positions,
+                                       const std::vector<u32> &indices, const OneRing &ring,
+                                       const VertexCorners &vc) {
+  BROC_ZONE("cotanWeights");
+  FaceGeometry faces = computeFaceGeometry(positions, indices);
+  const float cotanMax = std::cos(EPS) / std::sin(EPS);
+  std::vector<float> weight(ring.vertices.size(), 0.0f);
+  par::forChunks(ring.nVertices(), [&](size_t beg, size_t end) {
+    for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+      const u32 *row = ring.vertices.data() + ring.offsets[v];
+      const u32 valence = ring.valence(v);
+      auto add = [&](u32 to, float cot) {
+        u32 i = static_cast<u32>(std::find(row, row + valence, to) - row);
+        if (i < valence) {
+          weight[ring.offsets[v] + i] += cot;
+        }
+      };
+      for (u32 c = vc.offsets[v]; c < vc.offsets[v + 1]; ++c) {
+        u32 f = vc.corners[c] / 3;
+        u32 k = vc.corners[c] % 3;
+        u32 k1 = (k + 1) % 3;
+        u32 k2 = (k + 2) % 3;
+        // the edge to the next corner faces corner k2, the edge to the previous one faces k1
+        add(indices[3 * f + k1], faces.cot[k2][f]);
+        add(indices[3 * f + k2], faces.cot[k1][f]);
+      }
+      for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+        weight[i] = std::clamp(weight[i], -cotanMax, cotanMax);
+      }
+    }
+  });
+  return weight;
+}
+
+inline std::vector<float> cotanWeights(const coreMesh &mesh) {
+  return cotanWeights(mesh.positions, mesh.indices, mesh.ring, mesh.corners);
+}
+
+struct walkerOptions {
+  float tolerance = 1e-3f; // relative residual every label potential is solved to
+  u32 maxIterations = 200; // per label
+};
+
+// Random walker segmentation (Grady): the potential of label k is harmonic away from the seeds,
+// 1 on the seeds of k and 0 on the others, and every vertex takes the label with the largest
+// potential. The potentials of all labels sum to one, so K labels take K - 1 solves on the same
+// matrix and preconditioner; multi-label costs no more setup than two labels.
+//
+// Each solve is conjugate gradients preconditioned by one V-cycle of aggregation multigrid:
+// vertices are merged along strong edges into ever coarser levels, so a jump across the mesh
+// takes one cycle instead of as many iterations as the mesh is wide. Potentials are kept
+// between calls and start the next solve, so a new seed or a moved slider converges in a few
+// iterations. Everything per vertex runs on the worker pool in fixed chunks, sums are added in
+// chunk order and a solve repeats exactly.
+class randomWalker {
+public:
+  randomWalker() = default;
+  explicit randomWalker(std::vector<float> cotan) : cotan_(std::move(cotan)) {}
+  explicit randomWalker(const coreMesh &mesh) : cotan_(cotanWeights(mesh)) {}
+
+  bool empty() const { return cotan_.empty(); }
+  size_t nLevels() const { return levels_.size(); }
+  // conjugate gradient iterations of the last segment(), all labels together
+  u32 iterations() const { return iterations_; }
+  // potential of label k after the last segment(), for k < the number of labels
+  std::span<const float> potential(size_t k) const { return potential_[k]; }
+
+  // w = max(cot, 0) / (1 + beta |energy difference|): the cotangents spread the walk evenly over
+  // the surface, curvature jumps hold it back. Negative cotangents of obtuse pairs are dropped,
+  // which keeps every potential between 0 and 1. Vertices with |energy| > 100 are cut off, as
+  // in cutCapacities.
+  void setEnergy(const OneRing &ring, const std::vector<float> &energy, float beta = 100.0f) {
+    BROC_ZONE("walker weights");
+    weight_.resize(ring.vertices.size());
+    par::forChunks(ring.nVertices(), [&](size_t beg, size_t end) {
+      for (u32 v = static_cast<u32>(beg); v < end; ++v) {
+        for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+          float e1 = energy[v];
+          float e2 = energy[ring.vertices[i]];
+          bool cutOff = std::abs(e1) > 100 || std::abs(e2) > 100;
+          float w = std::max(cotan_[i], 0.0f) / (1.0f + beta * std::abs(e1 - e2));
+          weight_[i] = cutOff ? 0.0f : w;
+        }
+      }
+    });
+    seeds_.clear(); // the hierarchy is rebuilt on the next segment()
+  }
+
+  // labels every vertex, seeds[k] are the vertices of label k; setEnergy() first. stop is asked
+  // between iterations, the labels of the potentials so far are returned once it says yes.
+  std::vector<u32> segment(const OneRing &ring, const std::vector<std::vector<u32>> &seeds,
+                           const walkerOptions &options = {},
+                           const std::function<bool()> &stop = {}) {
+    BROC_ZONE("randomWalker");
+    const size_t n = ring.nVertices();
+    const u32 nLabels = static_cast<u32>(seeds.size());
+    iterations_ = 0;
+    if (seeds != seeds_) {
+      seeds_ = seeds;
+      seedLabel_.assign(n, noLabel);
+      for (u32 k = 0; k < nLabels; ++k) {
+        for (u32 v : seeds[k]) {
+          seedLabel_[v] = (seedLabel_[v] == noLabel) ? k : seedLabel_[v];
+        }
+      }
+      buildHierarchy(ring);
+    }
+    // sized up front, a stop can leave the later labels unsolved
+    potential_.resize(nLabels);
+    for (std::vector<float> &x : potential_) {
+      x.resize(n, 0.0f);
+    }
+    for (u32 k = 0; k + 1 < nLabels; ++k) {
+      std::vector<float> &x = potential_[k];
+      rightHandSide(ring, k);
+      iterations_ += solve(x, options, stop);
+      for (u32 v = 0; v < n; ++v) {
+        x[v] = (seedLabel_[v] == noLabel) ? x[v] : static_cast<float>(seedLabel_[v] == k);
+      }
+      if (stop && stop()) {
+        break;
+      }
+    }
+
+    // the last label gets whatever the others leave
+    std::vector<u32> label(n, 0);
+    par::forChunks(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        float rest = 1.0f;
+        float best = -1.0f;
+        for (u32 k = 0; k + 1 < nLabels; ++k) {
+          float p = potential_[k][v];
+          rest -= p;
+          if (p > best) {
+            best = p;
+            label[v] = k;
+          }
+        }
+        if (nLabels > 0) {
+          potential_.back()[v] = rest;
+          label[v] = (rest > best) ? nLabels - 1 : label[v];
+        }
+      }
+    });
+    return label;
+  }
+
+private:
+  static constexpr u32 noLabel = std::numeric_limits<u32>::max();
+  static constexpr u32 noVertex = std::numeric_limits<u32>::max();
+  static constexpr u32 minCoarse = 256;    // the coarsest level is solved by sweeps
+  static constexpr u32 coarseSweeps = 16;  // symmetric Gauss-Seidel sweeps on it
+  static constexpr float strongEdge = 0.25f; // of the strongest edge of the row
+  static constexpr float omega = 2.0f / 3.0f; // damped Jacobi smoothing
+  // piecewise constant prolongation undershoots smooth errors, scaling the coarse correction
+  // up about halves the iterations (Vanek, Brezina, Mandel)
+  static constexpr float overCorrection = 1.8f;
+  static constexpr size_t chunk = 16384;    // of every parallel pass and partial sum
+
+  // A = diag - weight in compressed rows, seeds are empty rows; aggregate[v] is the vertex v is
+  // merged into on the next level, members the inverse
+  struct level {
+    std::vector<u32> rowBeg;
+    std::vector<u32> col;
+    std::vector<float> weight;
+    std::vector<float> diag;
+    std::vector<float> invDiag; // 0 on empty rows
+    std::vector<u32> aggregate;
+    std::vector<u32> memberBeg;
+    std::vector<u32> members;
+    // V-cycle scratch
+    std::vector<float> r;
+    std::vector<float> x;
+    std::vector<float> t;
+
+    size_t size() const { return diag.size(); }
+  };
+
+  // f(beg, end) over fixed chunks of [0, n), on the worker pool
+  template <typename F> static void forEachChunk(size_t n, F &&f) {
+    size_t nChunks = (n + chunk - 1) / chunk;
+    par::forChunks(nChunks, [&](size_t cBeg, size_t cEnd) {
+      for (size_t c = cBeg; c < cEnd; ++c) {
+        f(c * chunk, std::min(n, (c + 1) * chunk));
+      }
+    }, 1);
+  }
+
+  // sum of f(beg, end) over the same chunks, added in chunk order
+  template <typename F> double chunkSum(size_t n, F &&f) {
+    partial_.assign((n + chunk - 1) / chunk, 0.0);
+    forEachChunk(n, [&](size_t beg, size_t end) { partial_[beg / chunk] = f(beg, end); });
+    return std::accumulate(partial_.begin(), partial_.end(), 0.0);
+  }
+
+  static float rowProduct(const level &l, std::span<const float> x, size_t v) {
+    float sum = l.diag[v] * x[v];
+    for (u32 i = l.rowBeg[v]; i < l.rowBeg[v + 1]; ++i) {
+      sum -= l.weight[i] * x[l.col[i]];
+    }
+    return sum;
+  }
+
+  // level 0 is the ring without the columns of seeds, every coarser one the Galerkin product
+  // P^T A P of the one above with P piecewise constant over aggregates
+  void buildHierarchy(const OneRing &ring) {
+    BROC_ZONE("walker hierarchy");
+    const size_t n = ring.nVertices();
+    levels_.resize(1);
+    level &fine = levels_[0];
+    if (fine.rowBeg != ring.offsets) {
+      fine.rowBeg = ring.offsets;
+      fine.col = ring.vertices;
+    }
+    fine.weight.resize(fine.col.size());
+    fine.diag.resize(n);
+    forEachChunk(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        float diag = 0.0f;
+        for (u32 i = fine.rowBeg[v]; i < fine.rowBeg[v + 1]; ++i) {
+          diag += weight_[i];
+          bool seed = seedLabel_[v] != noLabel || seedLabel_[fine.col[i]] != noLabel;
+          fine.weight[i] = seed ? 0.0f : weight_[i];
+        }
+        fine.diag[v] = (seedLabel_[v] != noLabel) ? 1.0f : diag;
+      }
+    });
+    for (size_t l = 0;; ++l) {
+      level &curr = levels_[l];
+      finishLevel(curr);
+      if (curr.size() <= minCoarse) {
+        break;
+      }
+      u32 nCoarse = aggregate(curr, l == 0);
+      if (nCoarse == 0 || nCoarse * 3 > curr.size() * 2) {
+        break;
+      }
+      level next = coarsen(curr, nCoarse);
+      levels_.push_back(std::move(next));
+    }
+    // the coarsest level aggregates nothing
+    levels_.back().aggregate.clear();
+  }
+
+  static void finishLevel(level &l) {
+    const size_t n = l.size();
+    l.invDiag.resize(n);
+    for (size_t v = 0; v < n; ++v) {
+      bool empty = l.rowBeg[v] == l.rowBeg[v + 1] || l.diag[v] <= 0.0f;
+      l.invDiag[v] = empty ? 0.0f : 1.0f / l.diag[v];
+    }
+    l.r.resize(n);
+    l.x.resize(n);
+    l.t.resize(n);
+  }
+
+  // Greedy aggregation (Vanek, Mandel, Brezina) over strong edges: a vertex whose strong
+  // neighbours are all free starts an aggregate with them, the rest join the neighbouring
+  // aggregate they are most strongly tied to. Seeds on level 0 join nothing. Returns the count.
+  u32 aggregate(level &l, bool skipSeeds) {
+    const size_t n = l.size();
+    l.aggregate.assign(n, noVertex);
+    maxWeight_.resize(n);
+    for (size_t v = 0; v < n; ++v) {
+      float m = 0.0f;
+      for (u32 i = l.rowBeg[v]; i < l.rowBeg[v + 1]; ++i) {
+        m = std::max(m, l.weight[i]);
+      }
+      maxWeight_[v] = m;
+    }
+    auto strong = [&](size_t v, u32 i) {
+      return l.weight[i] > 0.0f && l.weight[i] >= strongEdge * maxWeight_[v];
+    };
+    auto skip = [&](size_t v) { return skipSeeds && seedLabel_[v] != noLabel; };
+    u32 count = 0;
+    for (size_t v = 0; v < n; ++v) {
+      if (skip(v) || l.aggregate[v] != noVertex) {
+        continue;
+      }
+      bool free = true;
+      for (u32 i = l.rowBeg[v]; i < l.rowBeg[v + 1] && free; ++i) {
+        free = !strong(v, i) || l.aggregate[l.col[i]] == noVertex;
+      }
+      if (!free) {
+        continue;
+      }
+      l.aggregate[v] = count;
+      for (u32 i = l.rowBeg[v]; i < l.rowBeg[v + 1]; ++i) {
+        if (strong(v, i)) {
+          l.aggregate[l.col[i]] = count;
+        }
+      }
+      ++count;
+    }
+    for (size_t v = 0; v < n; ++v) {
+      if (skip(v) || l.aggregate[v] != noVertex) {
+        continue;
+      }
+      float best = 0.0f;
+      for (u32 i = l.rowBeg[v]; i < l.rowBeg[v + 1]; ++i) {
+        u32 a = l.aggregate[l.col[i]];
+        if (strong(v, i) && a != noVertex && l.weight[i] > best) {
+          best = l.weight[i];
+          l.aggregate[v] = a;
+        }
+      }
+      if (l.aggregate[v] == noVertex) {
+        l.aggregate[v] = count++;
+      }
+    }
+    return count;
+  }
+
+  // fills the members of fine and returns the next level
+  static level coarsen(level &fine, u32 nCoarse) {
+    level coarse;
+    const size_t n = fine.size();
+    std::vector<u32> &memberBeg = fine.memberBeg;
+    std::vector<u32> &members = fine.members;
+    memberBeg.assign(nCoarse + 1, 0);
+    for (u32 a : fine.aggregate) {
+      if (a != noVertex) {
+        ++memberBeg[a + 1];
+      }
+    }
+    std::partial_sum(memberBeg.begin(), memberBeg.end(), memberBeg.begin());
+    members.resize(memberBeg[nCoarse]);
+    std::vector<u32> fill(memberBeg.begin(), memberBeg.end() - 1);
+    for (u32 v = 0; v < n; ++v) {
+      if (fine.aggregate[v] != noVertex) {
+        members[fill[fine.aggregate[v]]++] = v;
+      }
+    }
+
+    coarse.rowBeg.assign(1, 0);
+    coarse.diag.assign(nCoarse, 0.0f);
+    std::vector<u32> slot(nCoarse, noVertex);
+    for (u32 c = 0; c < nCoarse; ++c) {
+      u32 rowBeg = static_cast<u32>(coarse.col.size());
+      for (u32 m = memberBeg[c]; m < memberBeg[c + 1]; ++m) {
+        u32 v = members[m];
+        coarse.diag[c] += fine.diag[v];
+        for (u32 i = fine.rowBeg[v]; i < fine.rowBeg[v + 1]; ++i) {
+          u32 a = fine.aggregate[fine.col[i]];
+          if (fine.weight[i] == 0.0f || a == noVertex) {
+            continue;
+          }
+          if (a == c) {
+            coarse.diag[c] -= fine.weight[i];
+          } else if (slot[a] == noVertex) {
+            slot[a] = static_cast<u32>(coarse.col.size());
+            coarse.col.push_back(a);
+            coarse.weight.push_back(fine.weight[i]);
+          } else {
+            coarse.weight[slot[a]] += fine.weight[i];
+          }
+        }
+      }
+      for (u32 i = rowBeg; i < coarse.col.size(); ++i) {
+        slot[coarse.col[i]] = noVertex;
+      }
+      coarse.rowBeg.push_back(static_cast<u32>(coarse.col.size()));
+    }
+    return coarse;
+  }
+
+  // b = A_US s for label k: what the seeds of k pull into their free neighbours
+  void rightHandSide(const OneRing &ring, u32 k) {
+    const size_t n = ring.nVertices();
+    b_.resize(n);
+    forEachChunk(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        float sum = 0.0f;
+        if (seedLabel_[v] == noLabel) {
+          for (u32 i = ring.offsets[v]; i < ring.offsets[v + 1]; ++i) {
+            sum += (seedLabel_[ring.vertices[i]] == k) ? weight_[i] : 0.0f;
+          }
+        }
+        b_[v] = sum;
+      }
+    });
+  }
+
+  // preconditioned conjugate gradients on level 0 from x, returns the iterations
+  u32 solve(std::vector<float> &x, const walkerOptions &options,
+            const std::function<bool()> &stop) {
+    BROC_ZONE("walker solve");
+    const level &l = levels_[0];
+    const size_t n = l.size();
+    r_.resize(n);
+    z_.resize(n);
+    p_.resize(n);
+    q_.resize(n);
+    double bNorm2 = chunkSum(n, [&](size_t beg, size_t end) {
+      double sum = 0.0;
+      for (size_t v = beg; v < end; ++v) {
+        x[v] = (seedLabel_[v] == noLabel) ? x[v] : 0.0f;
+        sum += double(b_[v]) * b_[v];
+      }
+      return sum;
+    });
+    if (bNorm2 == 0.0) {
+      std::fill(x.begin(), x.end(), 0.0f);
+      return 0;
+    }
+    double rNorm2 = chunkSum(n, [&](size_t beg, size_t end) {
+      double sum = 0.0;
+      for (size_t v = beg; v < end; ++v) {
+        r_[v] = b_[v] - rowProduct(l, x, v);
+        sum += double(r_[v]) * r_[v];
+      }
+      return sum;
+    });
+    const double target = double(options.tolerance) * options.tolerance * bNorm2;
+    vcycle(0, r_, z_);
+    double rz = chunkSum(n, [&](size_t beg, size_t end) {
+      double sum = 0.0;
+      for (size_t v = beg; v < end; ++v) {
+        p_[v] = z_[v];
+        sum += double(r_[v]) * z_[v];
+      }
+      return sum;
+    });
+    u32 it = 0;
+    for (; it < options.maxIterations && rNorm2 > target; ++it) {
+      if (stop && stop()) {
+        break;
+      }
+      double pq = chunkSum(n, [&](size_t beg, size_t end) {
+        double sum = 0.0;
+        for (size_t v = beg; v < end; ++v) {
+          q_[v] = rowProduct(l, p_, v);
+          sum += double(p_[v]) * q_[v];
+        }
+        return sum;
+      });
+      if (pq <= 0.0) {
+        break;
+      }
+      const float alpha = static_cast<float>(rz / pq);
+      rNorm2 = chunkSum(n, [&](size_t beg, size_t end) {
+        double sum = 0.0;
+        for (size_t v = beg; v < end; ++v) {
+          x[v] += alpha * p_[v];
+          r_[v] -= alpha * q_[v];
+          sum += double(r_[v]) * r_[v];
+        }
+        return sum;
+      });
+      vcycle(0, r_, z_);
+      double rzNext = chunkSum(n, [&](size_t beg, size_t end) {
+        double sum = 0.0;
+        for (size_t v = beg; v < end; ++v) {
+          sum += double(r_[v]) * z_[v];
+        }
+        return sum;
+      });
+      const float beta = static_cast<float>(rzNext / rz);
+      rz = rzNext;
+      forEachChunk(n, [&](size_t beg, size_t end) {
+        for (size_t v = beg; v < end; ++v) {
+          p_[v] = z_[v] + beta * p_[v];
+        }
+      });
+    }
+    return it;
+  }
+
+  // x += omega D^-1 (r - A x)
+  void jacobi(level &l, std::span<const float> r, std::span<float> x) {
+    forEachChunk(l.size(), [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        l.t[v] = r[v] - rowProduct(l, x, v);
+      }
+    });
+    forEachChunk(l.size(), [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        x[v] += omega * l.invDiag[v] * l.t[v];
+      }
+    });
+  }
+
+  // x = M^-1 r for one symmetric V-cycle from level k down, pre and post smoothing alike
+  void vcycle(size_t k, std::span<const float> r, std::span<float> x) {
+    level &l = levels_[k];
+    const size_t n = l.size();
+    if (k + 1 == levels_.size()) {
+      std::fill(x.begin(), x.end(), 0.0f);
+      for (u32 sweep = 0; sweep < coarseSweeps; ++sweep) {
+        for (size_t v = 0; v < n; ++v) {
+          x[v] += l.invDiag[v] * (r[v] - rowProduct(l, x, v));
+        }
+        for (size_t v = n; v-- > 0;) {
+          x[v] += l.invDiag[v] * (r[v] - rowProduct(l, x, v));
+        }
+      }
+      return;
+    }
+    level &next = levels_[k + 1];
+    forEachChunk(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        x[v] = omega * l.invDiag[v] * r[v];
+      }
+    });
+    forEachChunk(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        l.t[v] = r[v] - rowProduct(l, x, v);
+      }
+    });
+    forEachChunk(next.size(), [&](size_t beg, size_t end) {
+      for (size_t c = beg; c < end; ++c) {
+        float sum = 0.0f;
+        for (u32 m = l.memberBeg[c]; m < l.memberBeg[c + 1]; ++m) {
+          sum += l.t[l.members[m]];
+        }
+        next.r[c] = sum;
+      }
+    });
+    vcycle(k + 1, next.r, next.x);
+    forEachChunk(n, [&](size_t beg, size_t end) {
+      for (size_t v = beg; v < end; ++v) {
+        x[v] += (l.aggregate[v] != noVertex) ? overCorrection * next.x[l.aggregate[v]] : 0.0f;
+      }
+    });
+    jacobi(l, r, x);
+  }
+
+  std::vector<float> cotan_;
+  std::vector<float> weight_; // per ring entry
+  std::vector<std::vector<u32>> seeds_;
+  std::vector<u32> seedLabel_;
+  std::vector<level> levels_;
+  std::vector<std::vector<float>> potential_;
+  u32 iterations_ = 0;
+  // solve scratch
+  std::vector<float> b_;
+  std::vector<float> r_;
+  std::vector<float> z_;
+  std::vector<float> p_;
+  std::vector<float> q_;
+  std::vector<double> partial_;
+  std::vector<float> maxWeight_;
+};
+
+} // namespace math
+} // namespace brocseg
@@ -1,18 +1,48 @@
 R""(
 #version 400
-layout (location = 0) in vec3 vp;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec3 aColor;
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aNormal;
+layout (location = 2) in float aField;
+layout (location = 3) in uint aLabel;
 out vec3 Normal;
 out vec3 FragPos;
 out vec3 color;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+// positions arrive in [0, 1] per axis of the mesh box, normals octahedral in [-1, 1]^2
+uniform vec3 posOrigin;
+uniform vec3 posExtent;
+uniform vec2 fieldRange;
+uniform int showField;
+// label palette, label l is entry (l - 1)
+const float labelHue[12] = float[](0.0, 180.0, 270.0, 45.0, 225.0, 315.0,
+                                   15.0, 195.0, 285.0, 30.0, 210.0, 300.0);
+// math::rgbFromHsv with full saturation and value
+vec3 rgbFromHue(float h) {
+  return clamp(abs(mod(h * 6.0 + vec3(0.0, 4.0, 2.0), 6.0) - 3.0) - 1.0, 0.0, 1.0);
+}
+// math::octDecode
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
 void main() {
+  vec3 vp = posOrigin + aPos * posExtent;
   gl_Position = projection * view * model * vec4(vp, 1.0);
-  Normal = aNormal;
+  Normal = octDecode(aNormal);
   FragPos = vec3(model * vec4(vp, 1.0));
-  color = aColor;
+  if (aLabel != 0u) {
+    color = rgbFromHue(labelHue[(aLabel - 1u) % 12u] / 360.0);
+  } else if (showField != 0) {
+    // math::colorFromNormalized of normalize(field, m, M)
+    float span = max(fieldRange.y - fieldRange.x, 1e-20);
+    float t = clamp((aField - fieldRange.x) / span, 0.0, 1.0);
+    color = rgbFromHue(t * (240.0 / 360.0));
+  } else {
+    color = vec3(0.3, 0.3, 0.3);
+  }
 }
 )""